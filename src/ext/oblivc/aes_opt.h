@@ -35,10 +35,16 @@
 // number of batched key schedule
 #define KS_BATCH_N 8
 
+#define KS_ROUNDS 11 // AES-128: 10 rounds, plus the whitening key
+
+// One round key. A key schedule for KS_BATCH_N keys is an array of
+// KS_ROUNDS*KS_BATCH_N of these, round-major: round i of key j is at
+// [i*KS_BATCH_N+j], so that one round of consecutive keys is contiguous
+// (the VAES kernels load 2 or 4 of them at once). Kernels take a pointer to
+// their first key, &schedule[j], and index from there.
 typedef struct KEY_SCHEDULE
 {
-	ALIGN16 unsigned char KEY[16*15];
-	unsigned int nr;
+	ALIGN16 unsigned char KEY[16];
 } ROUND_KEYS;
 
 
@@ -56,8 +62,8 @@ typedef struct KEY_SCHEDULE
 	keyB_aux=_mm_aesenclast_si128 (x2, con); \
 	KS_BLOCK(1, keyB, keyB_aux);\
 	con=_mm_slli_epi32(con, 1);\
-	_mm_storeu_si128((__m128i *)(keys[0].KEY+i*16), keyA);\
-	_mm_storeu_si128((__m128i *)(keys[1].KEY+i*16), keyB);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+0].KEY), keyA);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+1].KEY), keyB);	\
 	}
 
 #define KS_round_2_last(i) { x2 =_mm_shuffle_epi8(keyA, mask); \
@@ -66,8 +72,8 @@ typedef struct KEY_SCHEDULE
 	keyB_aux=_mm_aesenclast_si128 (x2, con); \
 	KS_BLOCK(0, keyA, keyA_aux);\
 	KS_BLOCK(1, keyB, keyB_aux);\
-	_mm_storeu_si128((__m128i *)(keys[0].KEY+i*16), keyA);\
-	_mm_storeu_si128((__m128i *)(keys[1].KEY+i*16), keyB);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+0].KEY), keyA);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+1].KEY), keyB);	\
 	}
 
 #define KS_round_4(i) { x2 =_mm_shuffle_epi8(keyA, mask); \
@@ -83,10 +89,10 @@ typedef struct KEY_SCHEDULE
 	keyD_aux=_mm_aesenclast_si128 (x2, con); \
 	KS_BLOCK(3, keyD, keyD_aux);\
 	con=_mm_slli_epi32(con, 1);\
-	_mm_storeu_si128((__m128i *)(keys[0].KEY+i*16), keyA);\
-	_mm_storeu_si128((__m128i *)(keys[1].KEY+i*16), keyB);	\
-	_mm_storeu_si128((__m128i *)(keys[2].KEY+i*16), keyC);	\
-	_mm_storeu_si128((__m128i *)(keys[3].KEY+i*16), keyD);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+0].KEY), keyA);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+1].KEY), keyB);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+2].KEY), keyC);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+3].KEY), keyD);	\
 	}
 
 #define KS_round_4_last(i) { x2 =_mm_shuffle_epi8(keyA, mask); \
@@ -101,10 +107,10 @@ typedef struct KEY_SCHEDULE
 	KS_BLOCK(1, keyB, keyB_aux);\
 	KS_BLOCK(2, keyC, keyC_aux);\
 	KS_BLOCK(3, keyD, keyD_aux);\
-	_mm_storeu_si128((__m128i *)(keys[0].KEY+i*16), keyA);\
-	_mm_storeu_si128((__m128i *)(keys[1].KEY+i*16), keyB);	\
-	_mm_storeu_si128((__m128i *)(keys[2].KEY+i*16), keyC);	\
-	_mm_storeu_si128((__m128i *)(keys[3].KEY+i*16), keyD);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+0].KEY), keyA);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+1].KEY), keyB);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+2].KEY), keyC);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+3].KEY), keyD);	\
 	}
 
 #define KS_round_8(i) { x2 =_mm_shuffle_epi8(keyA, mask); \
@@ -132,14 +138,14 @@ typedef struct KEY_SCHEDULE
 	keyH_aux=_mm_aesenclast_si128 (x2, con); \
 	KS_BLOCK(7, keyH, keyH_aux);\
 	con=_mm_slli_epi32(con, 1);\
-	_mm_storeu_si128((__m128i *)(keys[0].KEY+i*16), keyA);\
-	_mm_storeu_si128((__m128i *)(keys[1].KEY+i*16), keyB);	\
-	_mm_storeu_si128((__m128i *)(keys[2].KEY+i*16), keyC);	\
-	_mm_storeu_si128((__m128i *)(keys[3].KEY+i*16), keyD);	\
-	_mm_storeu_si128((__m128i *)(keys[4].KEY+i*16), keyE);\
-	_mm_storeu_si128((__m128i *)(keys[5].KEY+i*16), keyF);	\
-	_mm_storeu_si128((__m128i *)(keys[6].KEY+i*16), keyG);	\
-	_mm_storeu_si128((__m128i *)(keys[7].KEY+i*16), keyH);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+0].KEY), keyA);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+1].KEY), keyB);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+2].KEY), keyC);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+3].KEY), keyD);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+4].KEY), keyE);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+5].KEY), keyF);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+6].KEY), keyG);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+7].KEY), keyH);	\
 	}
 
 #define KS_round_8_last(i) { x2 =_mm_shuffle_epi8(keyA, mask); \
@@ -166,111 +172,131 @@ typedef struct KEY_SCHEDULE
 	KS_BLOCK(5, keyF, keyF_aux);\
 	KS_BLOCK(6, keyG, keyG_aux);\
 	KS_BLOCK(7, keyH, keyH_aux);\
-	_mm_storeu_si128((__m128i *)(keys[0].KEY+i*16), keyA);\
-	_mm_storeu_si128((__m128i *)(keys[1].KEY+i*16), keyB);	\
-	_mm_storeu_si128((__m128i *)(keys[2].KEY+i*16), keyC);	\
-	_mm_storeu_si128((__m128i *)(keys[3].KEY+i*16), keyD);	\
-	_mm_storeu_si128((__m128i *)(keys[4].KEY+i*16), keyE);\
-	_mm_storeu_si128((__m128i *)(keys[5].KEY+i*16), keyF);	\
-	_mm_storeu_si128((__m128i *)(keys[6].KEY+i*16), keyG);	\
-	_mm_storeu_si128((__m128i *)(keys[7].KEY+i*16), keyH);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+0].KEY), keyA);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+1].KEY), keyB);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+2].KEY), keyC);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+3].KEY), keyD);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+4].KEY), keyE);\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+5].KEY), keyF);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+6].KEY), keyG);	\
+	_mm_storeu_si128((__m128i *)(keys[(i)*KS_BATCH_N+7].KEY), keyH);	\
 	}
 
-#define READ_KEYS_1(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[0].KEY+i*16));\
+#define READ_KEYS_1(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY));\
 	}
 	
-#define READ_KEYS_2(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[0].KEY+i*16));\
-	keyB = _mm_loadu_si128((__m128i const*)(keys[1].KEY+i*16));\
+#define READ_KEYS_2(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY));\
+	keyB = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY));\
 	}
 
-#define READ_KEYS_4(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[0].KEY+i*16));\
-	keyB = _mm_loadu_si128((__m128i const*)(keys[1].KEY+i*16));\
-	keyC = _mm_loadu_si128((__m128i const*)(keys[2].KEY+i*16));\
-	keyD = _mm_loadu_si128((__m128i const*)(keys[3].KEY+i*16));\
+#define READ_KEYS_4(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY));\
+	keyB = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY));\
+	keyC = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY));\
+	keyD = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY));\
 	}
 
-#define READ_KEYS_8(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[0].KEY+i*16));\
-	keyB = _mm_loadu_si128((__m128i const*)(keys[1].KEY+i*16));\
-	keyC = _mm_loadu_si128((__m128i const*)(keys[2].KEY+i*16));\
-	keyD = _mm_loadu_si128((__m128i const*)(keys[3].KEY+i*16));\
-	keyE = _mm_loadu_si128((__m128i const*)(keys[4].KEY+i*16));\
-	keyF = _mm_loadu_si128((__m128i const*)(keys[5].KEY+i*16));\
-	keyG = _mm_loadu_si128((__m128i const*)(keys[6].KEY+i*16));\
-	keyH = _mm_loadu_si128((__m128i const*)(keys[7].KEY+i*16));\
+#define READ_KEYS_8(i) {keyA = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY));\
+	keyB = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY));\
+	keyC = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY));\
+	keyD = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY));\
+	keyE = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+4].KEY));\
+	keyF = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+5].KEY));\
+	keyG = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+6].KEY));\
+	keyH = _mm_loadu_si128((__m128i const*)(keys[(i)*KS_BATCH_N+7].KEY));\
 	}
 
-#define ENC_round_11(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
+#define ENC_round_11(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
 	}
 
-#define ENC_round_11_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
+#define ENC_round_11_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
 	}
 
-#define ENC_round_12(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[0].KEY+i*16))); \
+#define ENC_round_12(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
 	}
 
-#define ENC_round_12_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[0].KEY+i*16))); \
+#define ENC_round_12_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	}
+	
+#define ENC_round_18(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block5=_mm_aesenc_si128(block5, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block6=_mm_aesenc_si128(block6, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block7=_mm_aesenc_si128(block7, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block8=_mm_aesenc_si128(block8, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	}
+
+#define ENC_round_18_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block5=_mm_aesenclast_si128(block5, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block6=_mm_aesenclast_si128(block6, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block7=_mm_aesenclast_si128(block7, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block8=_mm_aesenclast_si128(block8, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
 	}
 	
-#define ENC_round_22(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[1].KEY+i*16))); \
+#define ENC_round_22(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
 	}
 
-#define ENC_round_22_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[1].KEY+i*16))); \
+#define ENC_round_22_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
 	}
 
-#define ENC_round_24(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[1].KEY+i*16))); \
+#define ENC_round_24(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
 	}
 
-#define ENC_round_24_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[1].KEY+i*16))); \
+#define ENC_round_24_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
 	}
 
-#define ENC_round_48(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block5=_mm_aesenc_si128(block5, (*(__m128i const*)(keys[2].KEY+i*16))); \
-	block6=_mm_aesenc_si128(block6, (*(__m128i const*)(keys[2].KEY+i*16))); \
-	block7=_mm_aesenc_si128(block7, (*(__m128i const*)(keys[3].KEY+i*16))); \
-	block8=_mm_aesenc_si128(block8, (*(__m128i const*)(keys[3].KEY+i*16))); \
+#define ENC_round_48(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block5=_mm_aesenc_si128(block5, (*(__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY))); \
+	block6=_mm_aesenc_si128(block6, (*(__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY))); \
+	block7=_mm_aesenc_si128(block7, (*(__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY))); \
+	block8=_mm_aesenc_si128(block8, (*(__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY))); \
 	}
 
-#define ENC_round_48_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block5=_mm_aesenclast_si128(block5, (*(__m128i const*)(keys[2].KEY+i*16))); \
-	block6=_mm_aesenclast_si128(block6, (*(__m128i const*)(keys[2].KEY+i*16))); \
-	block7=_mm_aesenclast_si128(block7, (*(__m128i const*)(keys[3].KEY+i*16))); \
-	block8=_mm_aesenclast_si128(block8, (*(__m128i const*)(keys[3].KEY+i*16))); \
+#define ENC_round_48_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block5=_mm_aesenclast_si128(block5, (*(__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY))); \
+	block6=_mm_aesenclast_si128(block6, (*(__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY))); \
+	block7=_mm_aesenclast_si128(block7, (*(__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY))); \
+	block8=_mm_aesenclast_si128(block8, (*(__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY))); \
 	}
 
-#define ENC_round_88(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[2].KEY+i*16))); \
-	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[3].KEY+i*16))); \
-	block5=_mm_aesenc_si128(block5, (*(__m128i const*)(keys[4].KEY+i*16))); \
-	block6=_mm_aesenc_si128(block6, (*(__m128i const*)(keys[5].KEY+i*16))); \
-	block7=_mm_aesenc_si128(block7, (*(__m128i const*)(keys[6].KEY+i*16))); \
-	block8=_mm_aesenc_si128(block8, (*(__m128i const*)(keys[7].KEY+i*16))); \
+#define ENC_round_88(i) {block1=_mm_aesenc_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenc_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block3=_mm_aesenc_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY))); \
+	block4=_mm_aesenc_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY))); \
+	block5=_mm_aesenc_si128(block5, (*(__m128i const*)(keys[(i)*KS_BATCH_N+4].KEY))); \
+	block6=_mm_aesenc_si128(block6, (*(__m128i const*)(keys[(i)*KS_BATCH_N+5].KEY))); \
+	block7=_mm_aesenc_si128(block7, (*(__m128i const*)(keys[(i)*KS_BATCH_N+6].KEY))); \
+	block8=_mm_aesenc_si128(block8, (*(__m128i const*)(keys[(i)*KS_BATCH_N+7].KEY))); \
 	}
 
-#define ENC_round_88_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[0].KEY+i*16))); \
-	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[1].KEY+i*16))); \
-	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[2].KEY+i*16))); \
-	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[3].KEY+i*16))); \
-	block5=_mm_aesenclast_si128(block5, (*(__m128i const*)(keys[4].KEY+i*16))); \
-	block6=_mm_aesenclast_si128(block6, (*(__m128i const*)(keys[5].KEY+i*16))); \
-	block7=_mm_aesenclast_si128(block7, (*(__m128i const*)(keys[6].KEY+i*16))); \
-	block8=_mm_aesenclast_si128(block8, (*(__m128i const*)(keys[7].KEY+i*16))); \
+#define ENC_round_88_last(i) {block1=_mm_aesenclast_si128(block1, (*(__m128i const*)(keys[(i)*KS_BATCH_N+0].KEY))); \
+	block2=_mm_aesenclast_si128(block2, (*(__m128i const*)(keys[(i)*KS_BATCH_N+1].KEY))); \
+	block3=_mm_aesenclast_si128(block3, (*(__m128i const*)(keys[(i)*KS_BATCH_N+2].KEY))); \
+	block4=_mm_aesenclast_si128(block4, (*(__m128i const*)(keys[(i)*KS_BATCH_N+3].KEY))); \
+	block5=_mm_aesenclast_si128(block5, (*(__m128i const*)(keys[(i)*KS_BATCH_N+4].KEY))); \
+	block6=_mm_aesenclast_si128(block6, (*(__m128i const*)(keys[(i)*KS_BATCH_N+5].KEY))); \
+	block7=_mm_aesenclast_si128(block7, (*(__m128i const*)(keys[(i)*KS_BATCH_N+6].KEY))); \
+	block8=_mm_aesenclast_si128(block8, (*(__m128i const*)(keys[(i)*KS_BATCH_N+7].KEY))); \
 	}
 
 	static block sigma(block a) {
@@ -290,8 +316,6 @@ typedef struct KEY_SCHEDULE
 		unsigned int _con3[4]={0x0ffffffff, 0x0ffffffff, 0x07060504, 0x07060504};
 		__m128i con3=_mm_loadu_si128((__m128i const*)_con3);
 
-		keys[0].nr=10;
-		keys[1].nr=10;
 
 		keyA = _mm_loadu_si128((__m128i const*)(first_key));
 		keyB = _mm_loadu_si128((__m128i const*)(first_key+16));
@@ -327,10 +351,6 @@ typedef struct KEY_SCHEDULE
 		unsigned int _con3[4]={0x0ffffffff, 0x0ffffffff, 0x07060504, 0x07060504};
 		__m128i con3=_mm_loadu_si128((__m128i const*)_con3);
 
-		keys[0].nr=10;
-		keys[1].nr=10;
-		keys[2].nr=10;
-		keys[3].nr=10;
 
 		keyA = _mm_loadu_si128((__m128i const*)(first_key));
 		keyB = _mm_loadu_si128((__m128i const*)(first_key+16));
@@ -372,14 +392,6 @@ typedef struct KEY_SCHEDULE
 		unsigned int _con3[4]={0x0ffffffff, 0x0ffffffff, 0x07060504, 0x07060504};
 		__m128i con3 = _mm_loadu_si128((__m128i const*)_con3);
 
-		keys[0].nr=10;
-		keys[1].nr=10;
-		keys[2].nr=10;
-		keys[3].nr=10;
-		keys[4].nr=10;
-		keys[5].nr=10;
-		keys[6].nr=10;
-		keys[7].nr=10;
 
 		keyA = _mm_loadu_si128((__m128i const*)(first_key));
 		keyB = _mm_loadu_si128((__m128i const*)(first_key+16));
@@ -459,6 +471,8 @@ typedef struct KEY_SCHEDULE
 /*
  * AES encryptin with
  * 1 key 1 cipher
+ * 1 key 2 ciphers
+ * 1 key 8 ciphers
  * 2 keys 2 ciphers
  * 2 keys 4 ciphers
  * 4 keys 8 ciphers
@@ -517,6 +531,53 @@ typedef struct KEY_SCHEDULE
 		
 	}
 
+	static inline void AES_ecb_ccr_ks1_enc8(block *plaintext, block *ciphertext, ROUND_KEYS *KEYS) {
+		unsigned char* PT = (unsigned char*)plaintext;
+		unsigned char* CT = (unsigned char*)ciphertext;
+		ROUND_KEYS *keys = KEYS;
+		__m128i keyA;
+
+		__m128i block1 = _mm_loadu_si128((__m128i const*)(0*16+PT));
+		__m128i block2 = _mm_loadu_si128((__m128i const*)(1*16+PT));
+		__m128i block3 = _mm_loadu_si128((__m128i const*)(2*16+PT));
+		__m128i block4 = _mm_loadu_si128((__m128i const*)(3*16+PT));
+		__m128i block5 = _mm_loadu_si128((__m128i const*)(4*16+PT));
+		__m128i block6 = _mm_loadu_si128((__m128i const*)(5*16+PT));
+		__m128i block7 = _mm_loadu_si128((__m128i const*)(6*16+PT));
+		__m128i block8 = _mm_loadu_si128((__m128i const*)(7*16+PT));
+
+		READ_KEYS_1(0)
+
+		block1 = _mm_xor_si128(keyA, block1);
+		block2 = _mm_xor_si128(keyA, block2);
+		block3 = _mm_xor_si128(keyA, block3);
+		block4 = _mm_xor_si128(keyA, block4);
+		block5 = _mm_xor_si128(keyA, block5);
+		block6 = _mm_xor_si128(keyA, block6);
+		block7 = _mm_xor_si128(keyA, block7);
+		block8 = _mm_xor_si128(keyA, block8);
+
+		ENC_round_18(1)
+		ENC_round_18(2)
+		ENC_round_18(3)
+		ENC_round_18(4)
+		ENC_round_18(5)
+		ENC_round_18(6)
+		ENC_round_18(7)
+		ENC_round_18(8)
+		ENC_round_18(9)
+		ENC_round_18_last(10)
+
+		_mm_storeu_si128((__m128i *)(CT+0*16), block1);
+		_mm_storeu_si128((__m128i *)(CT+1*16), block2);
+		_mm_storeu_si128((__m128i *)(CT+2*16), block3);
+		_mm_storeu_si128((__m128i *)(CT+3*16), block4);
+		_mm_storeu_si128((__m128i *)(CT+4*16), block5);
+		_mm_storeu_si128((__m128i *)(CT+5*16), block6);
+		_mm_storeu_si128((__m128i *)(CT+6*16), block7);
+		_mm_storeu_si128((__m128i *)(CT+7*16), block8);
+	}
+
 	static inline void AES_ecb_ccr_ks2_enc2(block *plaintext, block *ciphertext, ROUND_KEYS *KEYS) {
 		unsigned char* PT = (unsigned char*)plaintext;
 		unsigned char* CT = (unsigned char*)ciphertext;
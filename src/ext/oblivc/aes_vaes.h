@@ -0,0 +1,188 @@
+/*
+ * VAES versions of the batch kernels in aes_opt.h, 2 (VAES-256) or 4
+ * (VAES-512) blocks per instruction. Each function is compiled for its own
+ * target, so this header can be built into a binary that also has to run
+ * on plain AES-NI hosts: mitccrh.c only calls them after checking cpuid.
+ * Results are bit-for-bit the same as the AES-NI kernels.
+ */
+
+#ifndef LIBGARBLE_AES_VAES_H
+#define LIBGARBLE_AES_VAES_H
+
+#include <immintrin.h>
+#include "aes_opt.h"
+
+#define VAES256_TARGET __attribute__((target("vaes,avx2")))
+#define VAES512_TARGET __attribute__((target("vaes,avx512f,avx512bw")))
+
+// Round i of keys j, j+1 (and j+2, j+3): contiguous in the round-major layout
+#define RK2(i, j) _mm256_loadu_si256((__m256i const*)keys[(i)*KS_BATCH_N+(j)].KEY)
+#define RK4(i, j) _mm512_loadu_si512((void const*)keys[(i)*KS_BATCH_N+(j)].KEY)
+
+/*
+ * AES key scheduling for 8 keys, same steps as KS_round_8
+ */
+	VAES256_TARGET
+	static void AES_ks8_vaes256(block* user_key, ROUND_KEYS *keys) {
+		__m256i key[4], aux, x2, globAux;
+		__m256i con = _mm256_set1_epi32(1);
+		__m256i mask = _mm256_set1_epi32(0x0c0f0e0d);
+		__m256i con3 = _mm256_set_epi32(0x07060504, 0x07060504, 0x0ffffffff, 0x0ffffffff,
+		                                0x07060504, 0x07060504, 0x0ffffffff, 0x0ffffffff);
+		int i, j;
+
+		for(j = 0; j < 4; j++) {
+			key[j] = _mm256_loadu_si256((__m256i const*)(user_key + 2 * j));
+			_mm256_storeu_si256((__m256i *)keys[2 * j].KEY, key[j]);
+		}
+		for(i = 1; i < KS_ROUNDS; i++) {
+			if(i == 9) con = _mm256_set1_epi32(0x1b);
+			for(j = 0; j < 4; j++) {
+				x2 = _mm256_shuffle_epi8(key[j], mask);
+				aux = _mm256_aesenclast_epi128(x2, con);
+				globAux = _mm256_slli_epi64(key[j], 32);
+				key[j] = _mm256_xor_si256(globAux, key[j]);
+				globAux = _mm256_shuffle_epi8(key[j], con3);
+				key[j] = _mm256_xor_si256(globAux, key[j]);
+				key[j] = _mm256_xor_si256(aux, key[j]);
+				_mm256_storeu_si256((__m256i *)keys[i * KS_BATCH_N + 2 * j].KEY, key[j]);
+			}
+			con = _mm256_slli_epi32(con, 1);
+		}
+	}
+
+	VAES512_TARGET
+	static void AES_ks8_vaes512(block* user_key, ROUND_KEYS *keys) {
+		__m512i key[2], aux, x2, globAux;
+		__m512i con = _mm512_set1_epi32(1);
+		__m512i mask = _mm512_set1_epi32(0x0c0f0e0d);
+		__m512i con3 = _mm512_broadcast_i32x4(
+			_mm_set_epi32(0x07060504, 0x07060504, 0x0ffffffff, 0x0ffffffff));
+		int i, j;
+
+		for(j = 0; j < 2; j++) {
+			key[j] = _mm512_loadu_si512((void const*)(user_key + 4 * j));
+			_mm512_storeu_si512((void *)keys[4 * j].KEY, key[j]);
+		}
+		for(i = 1; i < KS_ROUNDS; i++) {
+			if(i == 9) con = _mm512_set1_epi32(0x1b);
+			for(j = 0; j < 2; j++) {
+				x2 = _mm512_shuffle_epi8(key[j], mask);
+				aux = _mm512_aesenclast_epi128(x2, con);
+				globAux = _mm512_slli_epi64(key[j], 32);
+				key[j] = _mm512_xor_si512(globAux, key[j]);
+				globAux = _mm512_shuffle_epi8(key[j], con3);
+				key[j] = _mm512_xor_si512(globAux, key[j]);
+				key[j] = _mm512_xor_si512(aux, key[j]);
+				_mm512_storeu_si512((void *)keys[i * KS_BATCH_N + 4 * j].KEY, key[j]);
+			}
+			con = _mm512_slli_epi32(con, 1);
+		}
+	}
+
+/*
+ * AES encryption with
+ * 1 key, counter mode
+ * 4 keys 8 ciphers (2 per key, consecutive)
+ * 8 keys 8 ciphers
+ */
+	// Counter mode, out[i] = AES(ctr + i), for n a multiple of 16. One block
+	// per register would leave VAES waiting on aesenc latency, so 16 blocks
+	// are in flight at a time.
+	VAES256_TARGET
+	static void AES_ctr16_vaes256(ROUND_KEYS *keys, uint64_t ctr, block *out, size_t n) {
+		__m256i b[8], k, c = _mm256_set_epi64x(0, ctr + 1, 0, ctr);
+		__m256i step = _mm256_set_epi64x(0, 2, 0, 2);
+		size_t m;
+		int i, j;
+		for(m = 0; m < n; m += 16) {
+			k = _mm256_broadcastsi128_si256(*(__m128i const*)keys[0].KEY);
+			for(j = 0; j < 8; j++) {
+				b[j] = _mm256_xor_si256(c, k);
+				c = _mm256_add_epi64(c, step);
+			}
+			for(i = 1; i < KS_ROUNDS - 1; i++) {
+				k = _mm256_broadcastsi128_si256(*(__m128i const*)keys[i * KS_BATCH_N].KEY);
+				for(j = 0; j < 8; j++) b[j] = _mm256_aesenc_epi128(b[j], k);
+			}
+			k = _mm256_broadcastsi128_si256(*(__m128i const*)keys[i * KS_BATCH_N].KEY);
+			for(j = 0; j < 8; j++)
+				_mm256_storeu_si256((__m256i *)(out + m + 2 * j), _mm256_aesenclast_epi128(b[j], k));
+		}
+	}
+
+	// Blocks 2m, 2m+1 use key m. Regrouped so each register holds one block
+	// per key, in key order, which is how the keys lie in memory.
+	VAES256_TARGET
+	static void AES_ecb_ccr_ks4_enc8_vaes256(block *plaintext, block *ciphertext, ROUND_KEYS *keys) {
+		__m256i b[4], p, q;
+		int i, j;
+		for(j = 0; j < 2; j++) {
+			p = _mm256_loadu_si256((__m256i const*)(plaintext + 4 * j));
+			q = _mm256_loadu_si256((__m256i const*)(plaintext + 4 * j + 2));
+			b[2 * j] = _mm256_xor_si256(_mm256_permute2x128_si256(p, q, 0x20), RK2(0, 2 * j));
+			b[2 * j + 1] = _mm256_xor_si256(_mm256_permute2x128_si256(p, q, 0x31), RK2(0, 2 * j));
+		}
+		for(i = 1; i < KS_ROUNDS - 1; i++)
+			for(j = 0; j < 4; j++) b[j] = _mm256_aesenc_epi128(b[j], RK2(i, 2 * (j / 2)));
+		for(j = 0; j < 4; j++) b[j] = _mm256_aesenclast_epi128(b[j], RK2(i, 2 * (j / 2)));
+		for(j = 0; j < 2; j++) {
+			_mm256_storeu_si256((__m256i *)(ciphertext + 4 * j),
+				_mm256_permute2x128_si256(b[2 * j], b[2 * j + 1], 0x20));
+			_mm256_storeu_si256((__m256i *)(ciphertext + 4 * j + 2),
+				_mm256_permute2x128_si256(b[2 * j], b[2 * j + 1], 0x31));
+		}
+	}
+
+	VAES512_TARGET
+	static void AES_ecb_ccr_ks4_enc8_vaes512(block *plaintext, block *ciphertext, ROUND_KEYS *keys) {
+		__m512i p = _mm512_loadu_si512((void const*)plaintext);
+		__m512i q = _mm512_loadu_si512((void const*)(plaintext + 4));
+		__m512i x = _mm512_shuffle_i64x2(p, q, 0x88); // blocks 0, 2, 4, 6
+		__m512i y = _mm512_shuffle_i64x2(p, q, 0xDD); // blocks 1, 3, 5, 7
+		__m512i k = RK4(0, 0);
+		int i;
+		x = _mm512_xor_si512(x, k);
+		y = _mm512_xor_si512(y, k);
+		for(i = 1; i < KS_ROUNDS - 1; i++) {
+			k = RK4(i, 0);
+			x = _mm512_aesenc_epi128(x, k);
+			y = _mm512_aesenc_epi128(y, k);
+		}
+		k = RK4(i, 0);
+		x = _mm512_aesenclast_epi128(x, k);
+		y = _mm512_aesenclast_epi128(y, k);
+		_mm512_storeu_si512((void *)ciphertext,
+			_mm512_permutex2var_epi64(x, _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0), y));
+		_mm512_storeu_si512((void *)(ciphertext + 4),
+			_mm512_permutex2var_epi64(x, _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4), y));
+	}
+
+	VAES256_TARGET
+	static void AES_ecb_ccr_ks8_enc8_vaes256(block *plaintext, block *ciphertext, ROUND_KEYS *keys) {
+		__m256i b[4];
+		int i, j;
+		for(j = 0; j < 4; j++)
+			b[j] = _mm256_xor_si256(_mm256_loadu_si256((__m256i const*)(plaintext + 2 * j)), RK2(0, 2 * j));
+		for(i = 1; i < KS_ROUNDS - 1; i++)
+			for(j = 0; j < 4; j++) b[j] = _mm256_aesenc_epi128(b[j], RK2(i, 2 * j));
+		for(j = 0; j < 4; j++)
+			_mm256_storeu_si256((__m256i *)(ciphertext + 2 * j), _mm256_aesenclast_epi128(b[j], RK2(i, 2 * j)));
+	}
+
+	VAES512_TARGET
+	static void AES_ecb_ccr_ks8_enc8_vaes512(block *plaintext, block *ciphertext, ROUND_KEYS *keys) {
+		__m512i b[2];
+		int i, j;
+		for(j = 0; j < 2; j++)
+			b[j] = _mm512_xor_si512(_mm512_loadu_si512((void const*)(plaintext + 4 * j)), RK4(0, 4 * j));
+		for(i = 1; i < KS_ROUNDS - 1; i++)
+			for(j = 0; j < 2; j++) b[j] = _mm512_aesenc_epi128(b[j], RK4(i, 4 * j));
+		for(j = 0; j < 2; j++)
+			_mm512_storeu_si512((void *)(ciphertext + 4 * j), _mm512_aesenclast_epi128(b[j], RK4(i, 4 * j)));
+	}
+
+#undef RK2
+#undef RK4
+
+#endif
@@ -15,49 +15,49 @@
 
 typedef __m128i block;
 
-inline bool getLSB(const block x) {
+static inline bool getLSB(const block x) {
 	return (*((char *) &x) & 1) == 1;
 }
 
 __attribute__((target("sse2")))
-inline block makeBlock(int64_t x, int64_t y) {
+static inline block makeBlock(int64_t x, int64_t y) {
 	return _mm_set_epi64x(x, y);
 }
 
 __attribute__((target("sse2")))
-inline block zero_block() {
+static inline block zero_block() {
 	return _mm_setzero_si128();
 }
 
-inline block one_block() {
+static inline block one_block() {
 	return makeBlock(0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL);
 }
 
 __attribute__((target("sse2")))
-inline block make_delta(const block a) {
+static inline block make_delta(const block a) {
 	return _mm_or_si128(makeBlock(0L, 1L), a);
 }
 
 typedef __m128i block_tpl[2];
 
 __attribute__((target("sse2")))
-inline block xorBlocks(block x, block y) {
+static inline block xorBlocks(block x, block y) {
 	return _mm_xor_si128(x,y);
 }
 
 __attribute__((target("sse2")))
-inline block andBlocks(block x, block y) {
+static inline block andBlocks(block x, block y) {
 	return _mm_and_si128(x, y);
 }
 
-inline void xorBlocks_arr2(block* res, const block* x, const block* y, int nblocks) {
+static inline void xorBlocks_arr2(block* res, const block* x, const block* y, int nblocks) {
 	const block * dest = nblocks+x;
 	for (; x != dest;) {
 		*(res++) = xorBlocks(*(x++), *(y++));
 	}
 }
 
-inline void xorBlocks_arr(block* res, const block* x, block y, int nblocks) {
+static inline void xorBlocks_arr(block* res, const block* x, block y, int nblocks) {
 	const block * dest = nblocks+x;
 	for (; x != dest;) {
 		*(res++) = xorBlocks(*(x++), y);
@@ -65,7 +65,7 @@ inline void xorBlocks_arr(block* res, const block* x, block y, int nblocks) {
 }
 
 __attribute__((target("sse4")))
-inline bool cmpBlock(const block * x, const block * y, int nblocks) {
+static inline bool cmpBlock(const block * x, const block * y, int nblocks) {
 	const block *dest = nblocks + x;
 	for (; x != dest;) {
 		__m128i vcmp = _mm_xor_si128(*(x++), *(y++));
@@ -76,17 +76,17 @@ inline bool cmpBlock(const block * x, const block * y, int nblocks) {
 }
 
 //deprecate soon
-inline bool block_cmp(const block * x, const block * y, int nblocks) {
+static inline bool block_cmp(const block * x, const block * y, int nblocks) {
 	return cmpBlock(x,y,nblocks);
 }
 
 __attribute__((target("sse4")))
-inline bool isZero(const block * b) {
+static inline bool isZero(const block * b) {
 	return _mm_testz_si128(*b, *b) > 0;
 }
 
 __attribute__((target("sse4")))
-inline bool isOne(const block * b) {
+static inline bool isOne(const block * b) {
 	__m128i neq = _mm_xor_si128(*b, one_block());
 	return _mm_testz_si128(neq, neq) > 0;
 }
@@ -98,7 +98,7 @@ inline bool isOne(const block * b) {
 #define OUT(x, y) out[(y)*nrows / 8 + (x) / 8]
 
 __attribute__((target("sse2")))
-inline void sse_trans(uint8_t *out, uint8_t const *inp, uint64_t nrows,
+static inline void sse_trans(uint8_t *out, uint8_t const *inp, uint64_t nrows,
 		uint64_t ncols) {
 	uint64_t rr, cc;
 	int i, h;
@@ -167,7 +167,7 @@ inline void sse_trans(uint8_t *out, uint8_t const *inp, uint64_t nrows,
 		OUT(rr, cc + i) = _mm_movemask_epi8(tmp.x);
 }
 
-const char fix_key[] = "\x61\x7e\x8d\xa2\xa0\x51\x1e\x96"
+static const char fix_key[] = "\x61\x7e\x8d\xa2\xa0\x51\x1e\x96"
 					   "\x5e\x41\xc2\x9b\x15\x3f\xc7\x7a";
 
 /*
@@ -214,7 +214,7 @@ const char fix_key[] = "\x61\x7e\x8d\xa2\xa0\x51\x1e\x96"
   / Comments are welcome: Ted Krovetz <ted@krovetz.net> - Dedicated to Laurel K
   /------------------------------------------------------------------------- */
 	__attribute__((target("sse2")))
-	inline block double_block(block bl) {
+	static inline block double_block(block bl) {
 		const __m128i mask = _mm_set_epi32(135,1,1,1);
 		__m128i tmp = _mm_srai_epi32(bl, 31);
 		tmp = _mm_and_si128(tmp, mask);
@@ -224,14 +224,14 @@ const char fix_key[] = "\x61\x7e\x8d\xa2\xa0\x51\x1e\x96"
 	}
 
 	__attribute__((target("sse2")))
-	inline block LEFTSHIFT1(block bl) {
+	static inline block LEFTSHIFT1(block bl) {
 		const __m128i mask = _mm_set_epi32(0,0, (1<<31),0);
 		__m128i tmp = _mm_and_si128(bl,mask);
 		bl = _mm_slli_epi64(bl, 1);
 		return _mm_xor_si128(bl,tmp);
 	}
 	__attribute__((target("sse2")))
-	inline block RIGHTSHIFT(block bl) {
+	static inline block RIGHTSHIFT(block bl) {
 		const __m128i mask = _mm_set_epi32(0,1,0,0);
 		__m128i tmp = _mm_and_si128(bl,mask);
 		bl = _mm_slli_epi64(bl, 1);
@@ -261,7 +261,7 @@ const char fix_key[] = "\x61\x7e\x8d\xa2\xa0\x51\x1e\x96"
 	  Contact GitHub API Training Shop Blog About
 	 */
 	__attribute__((target("sse2,pclmul")))
-	inline void mul128(__m128i a, __m128i b, __m128i *res1, __m128i *res2) {
+	static inline void mul128(__m128i a, __m128i b, __m128i *res1, __m128i *res2) {
 		/*	block a0xora1 = xorBlocks(a, _mm_srli_si128(a, 8));
 			block b0xorb1 = xorBlocks(b, _mm_srli_si128(b, 8));
 
@@ -15,6 +15,8 @@ struct OcShareContext
 {
   OTsender sender;
   OTrecver recver;
+  COTsender csender; // wrap the objects in sender and recver, see cleanup
+  COTrecver crecver;
   BCipherRandomGen *gen,*padder;
   size_t padnonce;
 };
@@ -31,13 +33,19 @@ void ocShareInit(ProtocolDesc* pd)
   ctx->gen = newBCipherRandomGen();
   ctx->padder = newBCipherRandomGen();
   ctx->padnonce = 0;
+  struct SilentOTSender* s;
+  struct SilentOTRecver* r;
   if(me==1)
-  { ctx->sender = honestOTExtSenderAbstract(honestOTExtSenderNew(pd,2));
-    ctx->recver = honestOTExtRecverAbstract(honestOTExtRecverNew(pd,2));
+  { s = silentOTSenderNew(pd,2);
+    r = silentOTRecverNew(pd,2);
   }else
-  { ctx->recver = honestOTExtRecverAbstract(honestOTExtRecverNew(pd,1));
-    ctx->sender = honestOTExtSenderAbstract(honestOTExtSenderNew(pd,1));
+  { r = silentOTRecverNew(pd,1);
+    s = silentOTSenderNew(pd,1);
   }
+  ctx->sender = silentOTSenderAbstract(s);
+  ctx->recver = silentOTRecverAbstract(r);
+  ctx->csender = silentCOTSenderAbstract(s);
+  ctx->crecver = silentCOTRecverAbstract(r);
   // TODO eventually I should move this to a dedicated
   // That would also allow proper splitting on multithreaded
   ypd->extra = ctx;
@@ -51,6 +59,9 @@ void ocShareCleanup(ProtocolDesc* pd)
 {
   YaoProtocolDesc* ypd = pd->extra;
   struct OcShareContext* ctx = ypd->extra;
+  // csender and crecver wrap the same SilentOTSender and SilentOTRecver as
+  //   sender and recver. These two calls free both objects, so the COT
+  //   handles are dropped without a release of their own.
   otSenderRelease(&ctx->sender);
   otRecverRelease(&ctx->recver);
   releaseBCipherRandomGen(ctx->gen);
@@ -154,6 +165,7 @@ void evalGateToShare(ProtocolDesc* pd,struct OcShareContext* ctx,char* dest,
 // c = control bits, size n 
 // wc = control bits in yao wire form
 // t = scratch memory, size 4n*eltsize
+// The OTs are correlated: t comes out of them random, and only t^x0^x1 is sent
 void ocShareMuxes(ProtocolDesc* pd,char* z,     
                   const char* x0,const char* x1,size_t n,size_t eltsize,
                   const bool* c,const __obliv_c__bool* wc,char* t)
@@ -161,16 +173,15 @@ void ocShareMuxes(ProtocolDesc* pd,char* z,
   const size_t bufsz = n*eltsize;
   char *t2 = t+bufsz, *t3 = t+2*bufsz, *tr = t+3*bufsz;
   struct OcShareContext* ctx = protoShareCtx(pd);
+  struct CorrFunXorArgs args = {.len=eltsize, .mask=t3};
   int i;
-  memcpy(t2,x0,bufsz); memxor(t2,x1,bufsz); // t2 = x0^x1
-  randomizeBuffer(ctx->gen,t,bufsz);
-  memxor(t2,t,bufsz);
+  memcpy(t3,x0,bufsz); memxor(t3,x1,bufsz); // t3 = x0^x1
   if(protoCurrentParty(pd)==1)
-  { ctx->sender.send(ctx->sender.sender,t,t2,n,eltsize);
-    ctx->recver.recv(ctx->recver.recver,tr,c,n,eltsize);
+  { ctx->csender.send(ctx->csender.sender,t,t2,n,eltsize,corrFunXor,&args);
+    ctx->crecver.recv(ctx->crecver.recver,tr,c,n,eltsize);
   }else
-  { ctx->recver.recv(ctx->recver.recver,tr,c,n,eltsize);
-    ctx->sender.send(ctx->sender.sender,t,t2,n,eltsize);
+  { ctx->crecver.recv(ctx->crecver.recver,tr,c,n,eltsize);
+    ctx->csender.send(ctx->csender.sender,t,t2,n,eltsize,corrFunXor,&args);
   }
   for(i=0;i<n;++i) memmove(z+i*eltsize,(c[i]?x1:x0)+i*eltsize,eltsize);
   memxor(z,tr,bufsz);
@@ -55,7 +55,7 @@ bool dualexGenrRevealOblivBits(ProtocolDesc* pdb,
   { OblivBit t;
     __obliv_c__copyBit(&t,&o[i]);
     for(j=0;j<YAO_KEY_BYTES;++j) 
-      t.yao.w[j]^=((o[i].yao.inverted!=(bool)(destx&(1<<i)))?R[j]:z[j]);
+      t.yao.w[j]^=((o[i].yao.inverted!=(bool)(destx&(1LL<<i)))?R[j]:z[j]);
     gcry_md_write(pd->threadhash,t.yao.w,YAO_KEY_BYTES);
   }
   return res;
@@ -105,6 +105,7 @@ void* dualexThread(void* varg)
   // In this function, pd->ypd.thisParty == 1 always means generator
   pd->ypd.revealOblivBits = (role==1?dualexGenrRevealOblivBits
                                     :dualexEvalRevealOblivBits);
+  pd->ypd.revealOblivBitsN = NULL; // needs per-output hashing above
   mainYaoProtocol(&pd->ypd,true,arg->start,arg->startargs);
   yaoReleaseOt(&pd->ypd,role);
   cleanupYaoProtocol(&arg->pd->ypd);
@@ -1,10 +1,70 @@
 //The code is from EMP-toolkit (https://github.com/emp-toolkit/).
 
+#include <pthread.h>
 #include "mitccrh.h"
 #include "aes_opt.h"
+#include "aes_vaes.h"
+
+// Kernels for key renewal and the batched hashes, picked by aesImplLimit()
+static struct {
+	int impl;
+	void (*ks8)(block *user_key, ROUND_KEYS *keys);
+	void (*ctr16)(ROUND_KEYS *keys, uint64_t ctr, block *out, size_t n); // NULL: use ks1_enc8
+	void (*ks4_enc8)(block *plaintext, block *ciphertext, ROUND_KEYS *keys);
+	void (*ks8_enc8)(block *plaintext, block *ciphertext, ROUND_KEYS *keys);
+} aes_kernels = { .impl = -1 };
+// Garbling and OT worker threads all call aesImpl(), so the first pick
+// must happen exactly once
+static pthread_once_t aes_kernels_once = PTHREAD_ONCE_INIT;
+
+static int aesImplPick(int maxImpl) {
+	int impl = AES_IMPL_AESNI;
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2"))
+		impl = AES_IMPL_VAES256;
+	if(impl == AES_IMPL_VAES256 && __builtin_cpu_supports("avx512f")
+	   && __builtin_cpu_supports("avx512bw"))
+		impl = AES_IMPL_VAES512;
+	if(impl > maxImpl) impl = maxImpl;
+	switch(impl) {
+		case AES_IMPL_VAES512:
+			aes_kernels.ks8 = AES_ks8_vaes512;
+			aes_kernels.ctr16 = AES_ctr16_vaes256; // measured faster than 4-wide here
+			aes_kernels.ks4_enc8 = AES_ecb_ccr_ks4_enc8_vaes512;
+			aes_kernels.ks8_enc8 = AES_ecb_ccr_ks8_enc8_vaes512;
+			break;
+		case AES_IMPL_VAES256:
+			aes_kernels.ks8 = AES_ks8_vaes256;
+			aes_kernels.ctr16 = AES_ctr16_vaes256;
+			aes_kernels.ks4_enc8 = AES_ecb_ccr_ks4_enc8_vaes256;
+			aes_kernels.ks8_enc8 = AES_ecb_ccr_ks8_enc8_vaes256;
+			break;
+		default:
+			impl = AES_IMPL_AESNI;
+			aes_kernels.ks8 = AES_ks8;
+			aes_kernels.ctr16 = NULL;
+			aes_kernels.ks4_enc8 = AES_ecb_ccr_ks4_enc8;
+			aes_kernels.ks8_enc8 = AES_ecb_ccr_ks8_enc8;
+	}
+	aes_kernels.impl = impl;
+	return impl;
+}
+
+static void aesImplDefault(void) { aesImplPick(AES_IMPL_VAES512); }
+
+int aesImplLimit(int maxImpl) {
+	// after the default pick, so a later aesImpl() cannot undo this one
+	pthread_once(&aes_kernels_once, aesImplDefault);
+	return aesImplPick(maxImpl);
+}
+
+int aesImpl(void) {
+	pthread_once(&aes_kernels_once, aesImplDefault);
+	return aes_kernels.impl;
+}
 
 typedef struct{
-	ROUND_KEYS key_schedule[KS_BATCH_N];
+	ROUND_KEYS key_schedule[KS_ROUNDS * KS_BATCH_N];
 	int key_used;
 	block start_point;
 } MITCCRH;
@@ -13,6 +73,7 @@ typedef struct{
 
 void MITCCRH_init(proxy_MITCCRH *proxy_mitccrh){
 	proxy_mitccrh->addr = malloc(sizeof(MITCCRH));
+	aesImpl();
 	
 	GET_REAL_MITCCRH
 	mitccrh->key_used = KS_BATCH_N;
@@ -39,6 +100,14 @@ void MITCCRH_renew_ks_if_needed_2_keys(proxy_MITCCRH *proxy_mitccrh, uint64_t gi
 	}
 }
 
+void MITCCRH_renew_ks_if_needed_3_keys(proxy_MITCCRH *proxy_mitccrh, uint64_t gid) {
+	GET_REAL_MITCCRH
+	
+	if(mitccrh->key_used > KS_BATCH_N - 3) {
+		MITCCRH_renew_ks(proxy_mitccrh, gid);
+	}
+}
+
 void MITCCRH_renew_ks(proxy_MITCCRH *proxy_mitccrh, uint64_t gid) {
 	GET_REAL_MITCCRH
 	switch(KS_BATCH_N) {
@@ -46,8 +115,14 @@ void MITCCRH_renew_ks(proxy_MITCCRH *proxy_mitccrh, uint64_t gid) {
 			AES_ks2_index(mitccrh->start_point, gid, mitccrh->key_schedule); break;
 		case 4:
 			AES_ks4_index(mitccrh->start_point, gid, mitccrh->key_schedule); break;
-		case 8:
-			AES_ks8_index(mitccrh->start_point, gid, mitccrh->key_schedule); break;
+		case 8: { // AES_ks8_index, with the kernel picked at startup
+			block user_key[8];
+			int j;
+			for(j = 0; j < 8; j++)
+				user_key[j] = xorBlocks(makeBlock(2 * gid + j, (uint64_t)0), mitccrh->start_point);
+			aes_kernels.ks8(user_key, mitccrh->key_schedule);
+			break;
+		}
 		default:
 			abort();
 	}
@@ -115,4 +190,203 @@ void MITCCRH_k2_h4(proxy_MITCCRH *proxy_mitccrh, block A0, block A1, block B0, b
 	H[1] = xorBlocks(keys[1], masks[1]);
 	H[2] = xorBlocks(keys[2], masks[2]);
 	H[3] = xorBlocks(keys[3], masks[3]);
-}
\ No newline at end of file
+}
+// Three-halves garbling hashes A, B and A^B under one key each
+void MITCCRH_k3_h3(proxy_MITCCRH *proxy_mitccrh, block A, block B, block C, block *H) {
+	GET_REAL_MITCCRH
+	block keys[3], masks[3];
+	keys[0] = sigma(A);
+	keys[1] = sigma(B);
+	keys[2] = sigma(C);
+	memcpy(masks, keys, sizeof keys);
+
+	AES_ecb_ccr_ks2_enc2(keys, keys, &mitccrh->key_schedule[mitccrh->key_used]);
+	AES_ecb_ccr_ks1_enc1(keys + 2, keys + 2, &mitccrh->key_schedule[mitccrh->key_used + 2]);
+	mitccrh->key_used += 3;
+
+	H[0] = xorBlocks(keys[0], masks[0]);
+	H[1] = xorBlocks(keys[1], masks[1]);
+	H[2] = xorBlocks(keys[2], masks[2]);
+}
+
+void MITCCRH_k3_h6(proxy_MITCCRH *proxy_mitccrh, block A0, block A1, block B0, block B1, block C0, block C1, block *H) {
+	GET_REAL_MITCCRH
+	block keys[6], masks[6];
+	int i;
+	keys[0] = sigma(A0);
+	keys[1] = sigma(A1);
+	keys[2] = sigma(B0);
+	keys[3] = sigma(B1);
+	keys[4] = sigma(C0);
+	keys[5] = sigma(C1);
+	memcpy(masks, keys, sizeof keys);
+
+	AES_ecb_ccr_ks2_enc4(keys, keys, &mitccrh->key_schedule[mitccrh->key_used]);
+	AES_ecb_ccr_ks1_enc2(keys + 4, keys + 4, &mitccrh->key_schedule[mitccrh->key_used + 2]);
+	mitccrh->key_used += 3;
+
+	for(i = 0; i < 6; i++) H[i] = xorBlocks(keys[i], masks[i]);
+}
+
+// Same keys and renewals as n rounds of MITCCRH_renew_ks_if_needed_2_keys(gid)
+// and MITCCRH_k2_h4 with gid advancing by 2, but two gates per AES call.
+// in and H hold A0, A1, B0, B1 for each gate.
+void MITCCRH_k2_h4_n(proxy_MITCCRH *proxy_mitccrh, uint64_t gid, const block *in, block *H, size_t n) {
+	GET_REAL_MITCCRH
+	block keys[8];
+	size_t g = 0, i;
+	while(g < n) {
+		if(mitccrh->key_used == KS_BATCH_N || mitccrh->key_used == KS_BATCH_N - 1)
+			MITCCRH_renew_ks(proxy_mitccrh, gid + 2 * g);
+		if(n - g >= 2 && mitccrh->key_used + 4 <= KS_BATCH_N) {
+			for(i = 0; i < 8; i++) keys[i] = sigma(in[4 * g + i]);
+			aes_kernels.ks4_enc8(keys, H + 4 * g, &mitccrh->key_schedule[mitccrh->key_used]);
+			for(i = 0; i < 8; i++) H[4 * g + i] = xorBlocks(H[4 * g + i], keys[i]);
+			mitccrh->key_used += 4;
+			g += 2;
+		} else {
+			MITCCRH_k2_h4(proxy_mitccrh, in[4 * g], in[4 * g + 1], in[4 * g + 2], in[4 * g + 3], H + 4 * g);
+			g++;
+		}
+	}
+}
+
+// Evaluator side of the above: in and H hold A, B for each gate, and a whole
+// key schedule (four gates) is hashed per AES call.
+void MITCCRH_k2_h2_n(proxy_MITCCRH *proxy_mitccrh, uint64_t gid, const block *in, block *H, size_t n) {
+	GET_REAL_MITCCRH
+	block keys[8];
+	size_t g = 0, i;
+	while(g < n) {
+		if(mitccrh->key_used == KS_BATCH_N || mitccrh->key_used == KS_BATCH_N - 1)
+			MITCCRH_renew_ks(proxy_mitccrh, gid + 2 * g);
+		if(n - g >= 4 && mitccrh->key_used + 8 <= KS_BATCH_N) {
+			for(i = 0; i < 8; i++) keys[i] = sigma(in[2 * g + i]);
+			aes_kernels.ks8_enc8(keys, H + 2 * g, &mitccrh->key_schedule[mitccrh->key_used]);
+			for(i = 0; i < 8; i++) H[2 * g + i] = xorBlocks(H[2 * g + i], keys[i]);
+			mitccrh->key_used += 8;
+			g += 4;
+		} else {
+			MITCCRH_k2_h2(proxy_mitccrh, in[2 * g], in[2 * g + 1], H + 2 * g);
+			g++;
+		}
+	}
+}
+
+typedef struct{
+	ROUND_KEYS key_schedule[KS_ROUNDS * KS_BATCH_N]; // AES_ks2 fills keys 0 and 1, only 0 is used
+} AESCTR;
+
+#define GET_REAL_AESCTR AESCTR *aesctr = (AESCTR*) proxy_aesctr->addr;
+
+void AESCTR_init(proxy_AESCTR *proxy_aesctr){
+	proxy_aesctr->addr = malloc(sizeof(AESCTR));
+	aesImpl();
+}
+
+void AESCTR_release(proxy_AESCTR *proxy_aesctr){
+	free(proxy_aesctr->addr);
+	proxy_aesctr->addr = NULL;
+}
+
+void AESCTR_setKey(proxy_AESCTR *proxy_aesctr, block key) {
+	GET_REAL_AESCTR
+	block keys[2] = {key, key};
+	AES_ks2(keys, aesctr->key_schedule);
+}
+
+void AESCTR_gen(proxy_AESCTR *proxy_aesctr, uint64_t ctr, block *out, size_t n) {
+	GET_REAL_AESCTR
+	block in[8];
+	size_t i = 0, j;
+	if(aes_kernels.ctr16) {
+		i = n & ~(size_t)15;
+		aes_kernels.ctr16(aesctr->key_schedule, ctr, out, i);
+	}
+	for(; i + 8 <= n; i += 8) {
+		for(j = 0; j < 8; j++) in[j] = makeBlock(0, ctr + i + j);
+		AES_ecb_ccr_ks1_enc8(in, out + i, aesctr->key_schedule);
+	}
+	for(; i < n; i++) {
+		in[0] = makeBlock(0, ctr + i);
+		AES_ecb_ccr_ks1_enc1(in, out + i, aesctr->key_schedule);
+	}
+}
+
+typedef struct{
+	ROUND_KEYS key_schedule[KS_ROUNDS * KS_BATCH_N]; // key 0 is fix_key
+} TCCRH;
+
+#define GET_REAL_TCCRH TCCRH *tccrh = (TCCRH*) proxy_tccrh->addr;
+
+void TCCRH_init(proxy_TCCRH *proxy_tccrh){
+	proxy_tccrh->addr = malloc(sizeof(TCCRH));
+	GET_REAL_TCCRH
+	block key = _mm_loadu_si128((const block*)fix_key);
+	block keys[2] = {key, key};
+	AES_ks2(keys, tccrh->key_schedule);
+}
+
+void TCCRH_release(proxy_TCCRH *proxy_tccrh){
+	free(proxy_tccrh->addr);
+	proxy_tccrh->addr = NULL;
+}
+
+void TCCRH_hash_n(proxy_TCCRH *proxy_tccrh, const block *in, const uint64_t *tweak, block *H, size_t n) {
+	GET_REAL_TCCRH
+	block x[8], y[8];
+	size_t i = 0, j;
+	for(; i + 8 <= n; i += 8) {
+		AES_ecb_ccr_ks1_enc8((block*)in + i, x, tccrh->key_schedule);
+		for(j = 0; j < 8; j++) y[j] = xorBlocks(x[j], makeBlock(0, tweak[i + j]));
+		AES_ecb_ccr_ks1_enc8(y, H + i, tccrh->key_schedule);
+		for(j = 0; j < 8; j++) H[i + j] = xorBlocks(H[i + j], x[j]);
+	}
+	for(; i < n; i++) {
+		AES_ecb_ccr_ks1_enc1((block*)in + i, x, tccrh->key_schedule);
+		y[0] = xorBlocks(x[0], makeBlock(0, tweak[i]));
+		AES_ecb_ccr_ks1_enc1(y, H + i, tccrh->key_schedule);
+		H[i] = xorBlocks(H[i], x[0]);
+	}
+}
+
+typedef struct{
+	ROUND_KEYS key_schedule[KS_ROUNDS * KS_BATCH_N]; // keys 0 and 1 are pi_0, pi_1
+} GGMPRG;
+
+#define GET_REAL_GGMPRG GGMPRG *ggmprg = (GGMPRG*) proxy_ggmprg->addr;
+
+void GGMPRG_init(proxy_GGMPRG *proxy_ggmprg){
+	proxy_ggmprg->addr = malloc(sizeof(GGMPRG));
+	GET_REAL_GGMPRG
+	block key = _mm_loadu_si128((const block*)fix_key);
+	block keys[2] = {key, xorBlocks(key, makeBlock(0, 1))};
+	AES_ks2(keys, ggmprg->key_schedule);
+}
+
+void GGMPRG_release(proxy_GGMPRG *proxy_ggmprg){
+	free(proxy_ggmprg->addr);
+	proxy_ggmprg->addr = NULL;
+}
+
+void GGMPRG_expand(proxy_GGMPRG *proxy_ggmprg, const block *in, block *out, size_t n) {
+	GET_REAL_GGMPRG
+	block p[8], c0[8], c1[8];
+	size_t i = n, m, j;
+	while(i > 0) {
+		m = (i >= 8 ? 8 : i);
+		i -= m;
+		memcpy(p, in + i, m * sizeof(block));
+		if(m == 8) {
+			AES_ecb_ccr_ks1_enc8(p, c0, ggmprg->key_schedule);
+			AES_ecb_ccr_ks1_enc8(p, c1, ggmprg->key_schedule + 1);
+		} else for(j = 0; j < m; j++) {
+			AES_ecb_ccr_ks1_enc1(p + j, c0 + j, ggmprg->key_schedule);
+			AES_ecb_ccr_ks1_enc1(p + j, c1 + j, ggmprg->key_schedule + 1);
+		}
+		for(j = 0; j < m; j++) {
+			out[2 * (i + j)] = xorBlocks(c0[j], p[j]);
+			out[2 * (i + j) + 1] = xorBlocks(c1[j], p[j]);
+		}
+	}
+}
@@ -16,10 +16,54 @@ void MITCCRH_init(proxy_MITCCRH *proxy_mitccrh);
 void MITCCRH_setS(proxy_MITCCRH *proxy_mitccrh, __m128i sin);
 void MITCCRH_renew_ks_if_needed(proxy_MITCCRH *proxy_mitccrh, __uint64_t gid);
 void MITCCRH_renew_ks_if_needed_2_keys(proxy_MITCCRH *proxy_mitccrh, __uint64_t gid);
+void MITCCRH_renew_ks_if_needed_3_keys(proxy_MITCCRH *proxy_mitccrh, __uint64_t gid);
 void MITCCRH_renew_ks(proxy_MITCCRH *proxy_mitccrh, __uint64_t gid);
 void MITCCRH_k1_h1(proxy_MITCCRH *proxy_mitccrh, __m128i A, __m128i *H);
 void MITCCRH_k1_h2(proxy_MITCCRH *proxy_mitccrh, block A, block B, block *H);
 void MITCCRH_k2_h2(proxy_MITCCRH *proxy_mitccrh, __m128i A, __m128i B, __m128i *H);
 void MITCCRH_k2_h4(proxy_MITCCRH *proxy_mitccrh, __m128i A0, __m128i A1, __m128i B0, __m128i B1, __m128i *H);
+void MITCCRH_k3_h3(proxy_MITCCRH *proxy_mitccrh, __m128i A, __m128i B, __m128i C, __m128i *H);
+void MITCCRH_k3_h6(proxy_MITCCRH *proxy_mitccrh, __m128i A0, __m128i A1, __m128i B0, __m128i B1, __m128i C0, __m128i C1, __m128i *H);
+void MITCCRH_k2_h4_n(proxy_MITCCRH *proxy_mitccrh, __uint64_t gid, const block *in, block *H, size_t n);
+void MITCCRH_k2_h2_n(proxy_MITCCRH *proxy_mitccrh, __uint64_t gid, const block *in, block *H, size_t n);
+
+// Which AES kernels the batched paths use. Picked from cpuid on first use;
+// aesImplLimit() re-picks, never above maxImpl, and returns the choice.
+// Call aesImplLimit() before any protocol threads are running.
+#define AES_IMPL_AESNI   0
+#define AES_IMPL_VAES256 1 // 2 blocks per instruction (VAES + AVX2)
+#define AES_IMPL_VAES512 2 // 4 blocks per instruction (VAES + AVX-512)
+int aesImpl(void);
+int aesImplLimit(int maxImpl);
+
+// AES-128 in counter mode, out[i] = AES_key(ctr + i): input wire labels
+typedef struct{
+	char* addr;
+} proxy_AESCTR;
+
+void AESCTR_init(proxy_AESCTR *proxy_aesctr);
+void AESCTR_release(proxy_AESCTR *proxy_aesctr);
+void AESCTR_setKey(proxy_AESCTR *proxy_aesctr, __m128i key);
+void AESCTR_gen(proxy_AESCTR *proxy_aesctr, __uint64_t ctr, block *out, size_t n);
+
+// Fixed-key tweakable correlation-robust hash, H[i] = pi(pi(in[i]) ^ tweak[i])
+// ^ pi(in[i]), pi = AES under the public fix_key: pads for OT extension
+typedef struct{
+	char* addr;
+} proxy_TCCRH;
+
+void TCCRH_init(proxy_TCCRH *proxy_tccrh);
+void TCCRH_release(proxy_TCCRH *proxy_tccrh);
+void TCCRH_hash_n(proxy_TCCRH *proxy_tccrh, const block *in, const __uint64_t *tweak, block *H, size_t n);
+
+// GGM tree expansion under two fixed-key AES permutations, out[2i+b] =
+// pi_b(in[i]) ^ in[i]. Runs from the end, so out may be in
+typedef struct{
+	char* addr;
+} proxy_GGMPRG;
+
+void GGMPRG_init(proxy_GGMPRG *proxy_ggmprg);
+void GGMPRG_release(proxy_GGMPRG *proxy_ggmprg);
+void GGMPRG_expand(proxy_GGMPRG *proxy_ggmprg, const block *in, block *out, size_t n);
 
 #endif
\ No newline at end of file
@@ -15,6 +15,16 @@ void protocolUseTcp2P(ProtocolDesc* pd,int sock,bool isClient);
 void protocolUseTcp2PProfiled(ProtocolDesc* pd,int sock,bool isClient);
 void protocolUseTcp2PKeepAlive(ProtocolDesc* pd,int sock,bool isClient);
 void protocolAddSizeCheck(ProtocolDesc* pd);
+// Spreads traffic over this many connections, made by splitting the current
+//   one. Both parties call it with the same count, right after connecting.
+int protocolAddStriping(ProtocolDesc* pd,int lanes);
+// Both parties on one host: they map the file <path>.<session> (e.g. on
+//   tmpfs). session must be the same on both sides and fresh for every run,
+//   e.g. random and handed to both by whatever starts them. Exactly one side
+//   is the creator. Each waits up to a minute for the other, and returns -1
+//   if it does not show up. The file is gone once this returns.
+int protocolUseShm2P(ProtocolDesc* pd,const char* path,uint64_t session
+                    ,bool isCreator);
 // The old sockCount parameter (was the last param) is no longer used.
 int protocolConnectTcp2P(ProtocolDesc* pd,const char* server,const char* port);
 int protocolAcceptTcp2P(ProtocolDesc* pd,const char* port);
@@ -22,10 +32,17 @@ int protocolConnectTcp2PProfiled(ProtocolDesc* pd,const char* server,const char*
 int protocolAcceptTcp2PProfiled(ProtocolDesc* pd,const char* port);
 int protocolConnectTLS2P(ProtocolDesc* pd, const char* server, const char* port, const unsigned char *key, bool isProfiled, size_t buffer_size);
 int protocolAcceptTLS2P(ProtocolDesc* pd, const char* port, const unsigned char *key, bool isProfiled, size_t buffer_size);
+// Extended TLS setup, see TLS2POptions in obliv_types.h
+int protocolConnectTLS2PEx(ProtocolDesc* pd, const char* server, const char* port, const unsigned char *key, const TLS2POptions* opt);
+int protocolAcceptTLS2PEx(ProtocolDesc* pd, const char* port, const unsigned char *key, const TLS2POptions* opt);
 void cleanupProtocol(ProtocolDesc*);
 
 size_t tls2PBytesSent(ProtocolDesc* pd);
 size_t tls2PFlushCount(ProtocolDesc* pd);
+bool tls2PUsesKtls(ProtocolDesc* pd);
+// Process-wide count of TLS handshakes, split connections included, that
+//   resumed a cached session ticket vs. ran in full with the pre-shared key
+void tls2PHandshakeCounts(size_t* full, size_t* resumed);
 
 void setCurrentParty(ProtocolDesc* pd, int party);
 void execDebugProtocol(ProtocolDesc* pd, protocol_run start, void* arg);
@@ -33,6 +50,42 @@ void execNetworkStressProtocol(ProtocolDesc* pd, int bytecount,
                                protocol_run start, void* arg);
 void execYaoProtocol(ProtocolDesc* pd, protocol_run start, void* arg);
 void execYaoProtocol_noHalf(ProtocolDesc* pd, protocol_run start, void* arg);
+// Garbled tables are written out by a separate sender thread (and read in
+//   by a receiver thread, over TCP). Only the caller's side has to use it.
+void execYaoProtocol_pipelined(ProtocolDesc* pd, protocol_run start, void* arg);
+void execYaoProtocol_threeHalves(ProtocolDesc* pd, protocol_run start,
+                                 void* arg);
+// Random OTs for evaluator inputs, made ahead by a background thread on its
+//   own connection, which stays up to depth of them ahead. Feeds from party 2
+//   then cost a bit and two labels per input bit and no crypto. Call from
+//   inside a Yao run, at the same point on both sides. Prefill blocks until
+//   n are ready. Start returns false if the Yao run has no OT of its own.
+bool yaoOTPoolStart(ProtocolDesc* pd, size_t depth);
+void yaoOTPoolPrefill(ProtocolDesc* pd, size_t n);
+size_t yaoOTPoolDepth(ProtocolDesc* pd);
+// Offline/online Yao: the generator garbles everything ahead of time into
+//   tablePath (to be copied to the evaluator) and secretPath (kept private).
+//   Online, both parties run the same start(arg); path is secretPath for
+//   party 1, the table file for party 2. Each pair of files is single-use.
+int execYaoProtocolPregarble(const char* tablePath, const char* secretPath,
+                             protocol_run start, void* arg);
+int execYaoProtocolPregarbled(ProtocolDesc* pd, const char* path,
+                              protocol_run start, void* arg);
+// Circuit tracing: runs start(arg) as party with no peer, and writes the
+//   circuit it builds to path as a binary netlist (format in trace.c). Fed
+//   values are ignored and revealed ones unavailable (reveal* return false),
+//   so control flow must not depend on them. Returns 0 on success.
+typedef struct
+{ uint64_t wires; // including wire 0, the constant false
+  uint64_t andGates, xorGates; // OR is counted as AND, NOT is free
+  uint64_t inputBits, inputRecords;   // a record per feed call
+  uint64_t outputBits, outputRecords; // a record per reveal call
+} OcTraceCounts;
+int execTraceProtocol(const char* path, int party, protocol_run start,
+                      void* arg, OcTraceCounts* counts);
+// Writes a traced netlist out in Bristol Fashion, one input value per feed
+//   and one output value per reveal
+int traceNetlistToBristol(const char* netlistPath, const char* bristolPath);
 bool execDualexProtocol(ProtocolDesc* pd, protocol_run start, void* arg);
 bool execNpProtocol(ProtocolDesc* pd, protocol_run start, void* arg);
 bool execNpProtocol_Bcast1(ProtocolDesc* pd, protocol_run start, void* arg);
@@ -41,5 +94,13 @@ void execNnobProtocol(ProtocolDesc* pd, protocol_run start, void* arg, int numOT
 
 size_t tcp2PBytesSent(ProtocolDesc* pd);
 size_t tcp2PFlushCount(ProtocolDesc* pd);
+// Buffer size used for each direction (default 64 KiB), and MSG_ZEROCOPY for
+//   large sends (returns false if the kernel refuses it). Splits inherit both.
+void tcp2PSetBufferSize(ProtocolDesc* pd,size_t size);
+bool tcp2PUseZeroCopy(ProtocolDesc* pd);
+// Worker threads (and split connections) for large OT extension batches,
+//   default 8. Read when an OT sender/receiver first needs them, and both
+//   parties go with the smaller count; 1 keeps OT on the calling thread.
+void setOTThreadCount(int n);
 
 #endif // OBLIV_H
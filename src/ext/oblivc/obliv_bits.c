@@ -11,8 +11,16 @@
 #include <string.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <gcrypt.h>
 #include <openssl/ssl.h>
@@ -80,35 +88,125 @@ void protocolUseStdio(ProtocolDesc* pd)
 
 // TCP connections for 2-Party protocols. Ignores src/dest parameters
 //   since there is only one remote
+//
+// Buffered directly on the socket rather than through stdio: small sends
+//   are collected in wbuf, and a send that does not fit goes out together
+//   with the buffered bytes in a single sendmsg, without copying it first.
+//   Receives are served from rbuf, refilled with whatever is available.
 typedef struct tcp2PTransport
 { ProtocolTransport cb;
   int sock;
   bool isClient;
   bool isProfiled;
-  FILE* sockStream;
   bool needFlush;
   bool keepAlive;
   int sinceFlush;
   size_t bytes;
   size_t flushCount;
   struct tcp2PTransport* parent;
+  char *wbuf, *rbuf;
+  size_t wlen, rstart, rend, bufSize;
+  bool zeroCopy;      // large sends use MSG_ZEROCOPY
+  uint32_t zcIssued;  // number of MSG_ZEROCOPY sends so far
 } tcp2PTransport;
 
+#define TCP2P_DEFAULT_BUFFER_SIZE (1<<16)
+// Below this, pinning pages and waiting for the completion is not worth it
+#define TCP2P_ZEROCOPY_MIN (1<<18)
+
 // Profiling output
 size_t tcp2PBytesSent(ProtocolDesc* pd) { return ((tcp2PTransport*)(pd->trans))->bytes; }
 size_t tcp2PFlushCount(ProtocolDesc* pd) { return ((tcp2PTransport*)(pd->trans))->flushCount; }
 
+// Writes out all of iov, however many calls it takes
+static int tcpSendAll(int sock,struct iovec* iov,int iovcnt,int flags)
+{
+  size_t total=0;
+  while(iovcnt>0)
+  { struct msghdr msg = {.msg_iov=iov, .msg_iovlen=iovcnt};
+    ssize_t res = sendmsg(sock,&msg,flags|MSG_NOSIGNAL);
+    if(res<0)
+    { if(errno==EINTR) continue;
+      perror("TCP write error: "); return -1;
+    }
+    total+=res;
+    while(iovcnt>0 && res>=iov->iov_len) { res-=iov->iov_len; iov++; iovcnt--; }
+    if(iovcnt>0) { iov->iov_base=(char*)iov->iov_base+res; iov->iov_len-=res; }
+  }
+  return total;
+}
+
+// The kernel still references zero-copy buffers until it reports them done
+//   on the error queue. Our callers may reuse the buffer as soon as osend()
+//   returns, so wait for every outstanding completion here.
+static int tcpZeroCopyWait(tcp2PTransport* t,uint32_t before)
+{
+  uint32_t done=before;
+  while(done!=t->zcIssued)
+  { char control[128];
+    struct msghdr msg = {.msg_control=control, .msg_controllen=sizeof(control)};
+    if(recvmsg(t->sock,&msg,MSG_ERRQUEUE)<0)
+    { if(errno==EAGAIN || errno==EINTR)
+      { struct pollfd p = {.fd=t->sock, .events=0};
+        poll(&p,1,-1); // POLLERR is always reported
+        continue;
+      }
+      perror("TCP zerocopy completion: "); return -1;
+    }
+    struct cmsghdr* cm;
+    for(cm=CMSG_FIRSTHDR(&msg);cm!=NULL;cm=CMSG_NXTHDR(&msg,cm))
+    { struct sock_extended_err* err = (void*)CMSG_DATA(cm);
+      if(err->ee_origin==SO_EE_ORIGIN_ZEROCOPY) done=err->ee_data+1;
+    }
+  }
+  return 0;
+}
+
+static int tcp2PWriteBuffered(tcp2PTransport* t,const void* s,size_t n)
+{
+  struct iovec iov[2] = {{.iov_base=t->wbuf, .iov_len=t->wlen},
+                         {.iov_base=(void*)s, .iov_len=n}};
+  if(t->zeroCopy && n>=TCP2P_ZEROCOPY_MIN)
+  { if(t->wlen && tcpSendAll(t->sock,iov,1,0)<0) return -1;
+    t->wlen=0;
+    uint32_t before=t->zcIssued;
+    // MSG_ZEROCOPY notifications count sendmsg calls, so issue them one by
+    //   one to keep our count in step with the kernel's.
+    size_t n2=0;
+    while(n2<n)
+    { struct msghdr msg = {.msg_iov=&iov[1], .msg_iovlen=1};
+      iov[1].iov_base=(char*)s+n2; iov[1].iov_len=n-n2;
+      ssize_t res = sendmsg(t->sock,&msg,MSG_ZEROCOPY|MSG_NOSIGNAL);
+      if(res<0)
+      { if(errno==EINTR) continue;
+        if(errno==ENOBUFS) break; // out of pinnable memory: copy the rest
+        perror("TCP write error: "); return -1;
+      }
+      t->zcIssued++;
+      n2+=res;
+    }
+    if(tcpZeroCopyWait(t,before)<0) return -1;
+    if(n2<n)
+    { iov[1].iov_base=(char*)s+n2; iov[1].iov_len=n-n2;
+      if(tcpSendAll(t->sock,&iov[1],1,0)<0) return -1;
+    }
+    return n;
+  }
+  if(tcpSendAll(t->sock,iov,2,0)<0) return -1;
+  t->wlen=0;
+  return n;
+}
+
 static int tcp2PSend(ProtocolTransport* pt,int dest,const void* s,size_t n)
 {
   struct tcp2PTransport* tcpt = CAST(pt);
-  size_t n2=0;
   tcpt->needFlush=true;
-  while(n>n2) {
-    int res = fwrite(n2+(char*)s,1,n-n2,tcpt->sockStream);
-    if(res<0) { perror("TCP write error: "); return res; }
-    n2+=res;
+  if(tcpt->wlen+n<=tcpt->bufSize)
+  { memcpy(tcpt->wbuf+tcpt->wlen,s,n);
+    tcpt->wlen+=n;
+    return n;
   }
-  return n2;
+  return tcp2PWriteBuffered(tcpt,s,n);
 }
 
 static int tcp2PSendProfiled(ProtocolTransport* pt,int dest,const void* s,size_t n)
@@ -122,7 +220,7 @@ static int tcp2PSendProfiled(ProtocolTransport* pt,int dest,const void* s,size_t
 static int tcp2PRecv(ProtocolTransport* pt,int src,void* s,size_t n)
 {
   struct tcp2PTransport* tcpt = CAST(pt);
-  int res=0,n2=0;
+  size_t n2=0;
   if (tcpt->needFlush)
   {
     transFlush(pt);
@@ -130,21 +228,38 @@ static int tcp2PRecv(ProtocolTransport* pt,int src,void* s,size_t n)
   }
   while(n>n2)
   {
-    res = fread(n2+(char*)s,1,n-n2, tcpt->sockStream);
-    if(res<0 || feof(tcpt->sockStream))
-    {
-      perror("TCP read error: ");
-      return res;
+    size_t avail = tcpt->rend-tcpt->rstart;
+    if(avail==0)
+    { // Big reads go straight to the destination
+      bool direct = (n-n2>=tcpt->bufSize);
+      ssize_t res = (direct ? read(tcpt->sock,n2+(char*)s,n-n2)
+                            : read(tcpt->sock,tcpt->rbuf,tcpt->bufSize));
+      if(res<0 && errno==EINTR) continue;
+      if(res<=0)
+      {
+        perror("TCP read error: ");
+        return -1;
+      }
+      if(direct) { n2+=res; continue; }
+      tcpt->rstart=0;
+      tcpt->rend=avail=res;
     }
-    n2+=res;
+    if(avail>n-n2) avail=n-n2;
+    memcpy(n2+(char*)s,tcpt->rbuf+tcpt->rstart,avail);
+    tcpt->rstart+=avail;
+    n2+=avail;
   }
-  return res;
+  return n2;
 }
 
 static int tcp2PFlush(ProtocolTransport* pt)
 {
   struct tcp2PTransport* tcpt = CAST(pt);
-  return fflush(tcpt->sockStream);
+  if(tcpt->wlen==0) return 0;
+  struct iovec iov = {.iov_base=tcpt->wbuf, .iov_len=tcpt->wlen};
+  if(tcpSendAll(tcpt->sock,&iov,1,0)<0) return -1;
+  tcpt->wlen=0;
+  return 0;
 }
 
 static int tcp2PFlushProfiled(ProtocolTransport* pt)
@@ -157,8 +272,10 @@ static int tcp2PFlushProfiled(ProtocolTransport* pt)
 static void tcp2PCleanup(ProtocolTransport* pt)
 {
   tcp2PTransport* t = CAST(pt);
-  fflush(t->sockStream);
-  if(!t->keepAlive) fclose(t->sockStream);
+  tcp2PFlush(pt);
+  if(!t->keepAlive) close(t->sock);
+  free(t->wbuf);
+  free(t->rbuf);
   free(pt);
 }
 
@@ -173,13 +290,8 @@ static void tcp2PCleanupProfiled(ProtocolTransport* pt)
   tcp2PCleanup(pt);
 }
 
-static inline bool transIsTcp2P(ProtocolTransport* pt) { return pt->cleanup == tcp2PCleanup; }
-
-FILE* transGetFile(ProtocolTransport* t)
-{
-  if(transIsTcp2P(t)) return ((tcp2PTransport*)t)->sockStream;
-  else return NULL;
-}
+static inline bool transIsTcp2P(ProtocolTransport* pt)
+  { return pt->cleanup == tcp2PCleanup || pt->cleanup == tcp2PCleanupProfiled; }
 
 static ProtocolTransport* tcp2PSplit(ProtocolTransport* tsrc);
 
@@ -209,14 +321,45 @@ static tcp2PTransport* tcp2PNew(int sock,bool isClient, bool isProfiled)
   trans->sock = sock;
   trans->isProfiled=isProfiled;
   trans->isClient=isClient;
-  trans->sockStream=fdopen(sock, "rb+");
   trans->sinceFlush = 0;
+  trans->keepAlive = false;
+  trans->bufSize = TCP2P_DEFAULT_BUFFER_SIZE;
+  trans->wbuf = malloc(trans->bufSize);
+  trans->rbuf = malloc(trans->bufSize);
+  trans->wlen = trans->rstart = trans->rend = 0;
+  trans->zeroCopy = false;
+  trans->zcIssued = 0;
   const int one=1;
   setsockopt(sock,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
-  /*setvbuf(trans->sockStream, trans->buffer, _IOFBF, BUFFER_SIZE);*/
   return trans;
 }
 
+// Tuning knobs. Both apply to later splits as well.
+void tcp2PSetBufferSize(ProtocolDesc* pd,size_t size)
+{
+  tcp2PTransport* t = CAST(pd->trans);
+  if(!transIsTcp2P(pd->trans) || size==0) return;
+  transFlush(pd->trans);
+  // keep whatever was read ahead
+  size_t avail = t->rend-t->rstart;
+  char* rbuf = malloc(size>avail?size:avail);
+  memcpy(rbuf,t->rbuf+t->rstart,avail);
+  free(t->rbuf);
+  t->rbuf=rbuf; t->rstart=0; t->rend=avail;
+  t->wbuf=realloc(t->wbuf,size);
+  t->bufSize=size;
+}
+
+// Returns false if the kernel does not support MSG_ZEROCOPY
+bool tcp2PUseZeroCopy(ProtocolDesc* pd)
+{
+  tcp2PTransport* t = CAST(pd->trans);
+  const int one=1;
+  if(!transIsTcp2P(pd->trans)) return false;
+  t->zeroCopy = (setsockopt(t->sock,SOL_SOCKET,SO_ZEROCOPY,&one,sizeof(one))==0);
+  return t->zeroCopy;
+}
+
 void protocolUseTcp2P(ProtocolDesc* pd,int sock,bool isClient)
 {
   pd->trans = &tcp2PNew(sock,isClient, false)->cb;
@@ -350,18 +493,31 @@ static int sockSplit(int sock,ProtocolTransport* t,bool isClient)
   }
 }
 
-static ProtocolTransport* tcp2PSplit(ProtocolTransport* tsrc)
+// via carries the new port number: tsrc itself, or a transport layered on it
+static tcp2PTransport* tcp2PSplitVia(ProtocolTransport* tsrc,ProtocolTransport* via)
 {
   tcp2PTransport* t = CAST(tsrc);
-  transFlush(tsrc);
-  // I should really rewrite sockSplit to use FILE* sockStream
-  int newsock = sockSplit(t->sock,tsrc,t->isClient);
+  transFlush(via);
+  int newsock = sockSplit(t->sock,via,t->isClient);
   if(newsock<0) { fprintf(stderr,"sockSplit() failed\n"); return NULL; }
   tcp2PTransport* tnew = tcp2PNew(newsock,t->isClient,t->isProfiled);
   tnew->parent=t;
-  return CAST(tnew);
+  if(t->bufSize!=tnew->bufSize)
+  { tnew->bufSize=t->bufSize;
+    tnew->wbuf=realloc(tnew->wbuf,t->bufSize);
+    tnew->rbuf=realloc(tnew->rbuf,t->bufSize);
+  }
+  if(t->zeroCopy)
+  { const int one=1;
+    tnew->zeroCopy =
+      (setsockopt(newsock,SOL_SOCKET,SO_ZEROCOPY,&one,sizeof(one))==0);
+  }
+  return tnew;
 }
 
+static ProtocolTransport* tcp2PSplit(ProtocolTransport* tsrc)
+  { return CAST(tcp2PSplitVia(tsrc,tsrc)); }
+
 // --------------------------- TLS trans -----------------------------------
 
 // TLS connections for 2-Party protocols. Ignores src/dest parameters
@@ -370,6 +526,232 @@ static ProtocolTransport* tcp2PSplit(ProtocolTransport* tsrc)
 // For two-party computation with semi-honest security, we only ensure
 //   authenticity, but no confidentiality of the two parties' transcript.
 
+// Optional multiplexing of many logical streams over one TLS connection, so
+//   that split() needs neither a new socket nor a new handshake. Each write
+//   becomes a frame (8-byte stream id, 4-byte length, payload) that fits in
+//   a single TLS record. A demux thread owns the read side and queues the
+//   payloads per stream. The socket is non-blocking, so that the demux thread
+//   never sits on ssl_lock while waiting for data.
+#define TLS_MUX_HEADER 12
+#define TLS_MUX_MAX_PAYLOAD (16384 - TLS_MUX_HEADER)
+
+typedef struct tlsMuxChunk
+{ struct tlsMuxChunk* next;
+  size_t len, off;
+  unsigned char data[];
+} tlsMuxChunk;
+
+typedef struct
+{ uint64_t id;
+  tlsMuxChunk *head, *tail;
+} tlsMuxStream;
+
+typedef struct
+{ SSL* ssl;
+  int sock;
+  int wakefd[2];
+  pthread_t demux;
+  pthread_mutex_t ssl_lock;   // held only around SSL_read/SSL_write calls
+  pthread_mutex_t write_lock; // held for a whole frame, across retries
+  pthread_mutex_t lock;       // protects the fields below
+  pthread_cond_t cond;
+  tlsMuxStream* streams;      // never shrinks, so indices stay valid
+  size_t streamCount, streamCap;
+  int refs;
+  bool eof;
+  unsigned char frame[TLS_MUX_HEADER + TLS_MUX_MAX_PAYLOAD];
+} tlsMux;
+
+static size_t tlsMuxStreamIndex(tlsMux* m, uint64_t id){
+  size_t i;
+  for(i = 0; i < m->streamCount; i++) if(m->streams[i].id == id) return i;
+  if(m->streamCount == m->streamCap){
+    m->streamCap = 2 * m->streamCap + 8;
+    m->streams = realloc(m->streams, m->streamCap * sizeof(*m->streams));
+  }
+  m->streams[i] = (tlsMuxStream){.id = id, .head = NULL, .tail = NULL};
+  m->streamCount++;
+  return i;
+}
+
+// Waits a little for the socket. The timeout only bounds the latency of
+//   retries, so that we never need the demux thread to wake writers up.
+static void tlsMuxPoll(int sock, int err){
+  struct pollfd p = {.fd = sock,
+                     .events = (err == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN)};
+  poll(&p, 1, 10);
+}
+
+static int tlsMuxWrite(tlsMux* m, uint64_t id, const char* s, size_t n){
+  size_t n2 = 0;
+  pthread_mutex_lock(&m->write_lock);
+  while(n > n2){
+    uint32_t len = (n - n2 > TLS_MUX_MAX_PAYLOAD ? TLS_MUX_MAX_PAYLOAD : n - n2);
+    memcpy(m->frame, &id, 8);
+    memcpy(m->frame + 8, &len, 4);
+    memcpy(m->frame + TLS_MUX_HEADER, s + n2, len);
+    while(true){
+      pthread_mutex_lock(&m->ssl_lock);
+      int res = SSL_write(m->ssl, m->frame, TLS_MUX_HEADER + len);
+      int err = (res > 0 ? SSL_ERROR_NONE : SSL_get_error(m->ssl, res));
+      pthread_mutex_unlock(&m->ssl_lock);
+      if(res > 0) break;
+      if(err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ){
+        pthread_mutex_unlock(&m->write_lock);
+        fprintf(stderr, "TLS write error: %d\n", err);
+        return -1;
+      }
+      tlsMuxPoll(m->sock, err);
+    }
+    n2 += len;
+  }
+  pthread_mutex_unlock(&m->write_lock);
+  return n2;
+}
+
+static void* tlsMuxDemux(void* va){
+  tlsMux* m = va;
+  unsigned char buf[16384], hdr[TLS_MUX_HEADER];
+  size_t hdrlen = 0;
+  uint32_t left = 0;
+  uint64_t id = 0;
+  tlsMuxChunk* cur = NULL;
+  while(true){
+    pthread_mutex_lock(&m->ssl_lock);
+    int res = SSL_read(m->ssl, buf, sizeof(buf));
+    int err = (res > 0 ? SSL_ERROR_NONE : SSL_get_error(m->ssl, res));
+    pthread_mutex_unlock(&m->ssl_lock);
+    if(res <= 0){
+      if(err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) break;
+      struct pollfd p[2] = {
+        {.fd = m->sock, .events = (err == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN)},
+        {.fd = m->wakefd[0], .events = POLLIN}};
+      poll(p, 2, -1);
+      if(p[1].revents) break;
+      continue;
+    }
+    size_t i = 0;
+    while(i < res){
+      if(cur == NULL){ // still reading a frame header
+        size_t k = TLS_MUX_HEADER - hdrlen;
+        if(k > res - i) k = res - i;
+        memcpy(hdr + hdrlen, buf + i, k);
+        hdrlen += k; i += k;
+        if(hdrlen < TLS_MUX_HEADER) break;
+        hdrlen = 0;
+        memcpy(&id, hdr, 8);
+        memcpy(&left, hdr + 8, 4);
+        cur = malloc(sizeof(*cur) + left);
+        cur->next = NULL;
+        cur->len = left;
+        cur->off = 0;
+      }
+      size_t k = (left > res - i ? res - i : left);
+      memcpy(cur->data + cur->len - left, buf + i, k);
+      left -= k; i += k;
+      if(left == 0){
+        pthread_mutex_lock(&m->lock);
+        tlsMuxStream* st = &m->streams[tlsMuxStreamIndex(m, id)];
+        if(st->tail) st->tail->next = cur; else st->head = cur;
+        st->tail = cur;
+        pthread_cond_broadcast(&m->cond);
+        pthread_mutex_unlock(&m->lock);
+        cur = NULL;
+      }
+    }
+  }
+  free(cur);
+  pthread_mutex_lock(&m->lock);
+  m->eof = true;
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->lock);
+  return NULL;
+}
+
+static int tlsMuxRead(tlsMux* m, uint64_t id, char* s, size_t n){
+  size_t n2 = 0;
+  pthread_mutex_lock(&m->lock);
+  size_t i = tlsMuxStreamIndex(m, id);
+  while(n > n2){
+    tlsMuxStream* st = &m->streams[i];
+    tlsMuxChunk* c = st->head;
+    if(c == NULL){
+      if(m->eof){
+        pthread_mutex_unlock(&m->lock);
+        fprintf(stderr, "TLS read error: connection closed\n");
+        return -1;
+      }
+      pthread_cond_wait(&m->cond, &m->lock);
+      continue;
+    }
+    size_t k = (c->len - c->off > n - n2 ? n - n2 : c->len - c->off);
+    memcpy(s + n2, c->data + c->off, k);
+    c->off += k; n2 += k;
+    if(c->off == c->len){
+      st->head = c->next;
+      if(st->head == NULL) st->tail = NULL;
+      free(c);
+    }
+  }
+  pthread_mutex_unlock(&m->lock);
+  return n2;
+}
+
+// Both parties split in the same order, so stream ids can be derived
+//   locally from the parent's id and its split count.
+static uint64_t tlsMuxChildId(uint64_t parent, uint64_t k){
+  uint64_t z = parent + k * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static tlsMux* tlsMuxNew(SSL* ssl, int sock){
+  tlsMux* m = malloc(sizeof(*m));
+  m->ssl = ssl;
+  m->sock = sock;
+  if(pipe(m->wakefd) < 0) { free(m); return NULL; }
+  pthread_mutex_init(&m->ssl_lock, NULL);
+  pthread_mutex_init(&m->write_lock, NULL);
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->cond, NULL);
+  m->streams = NULL;
+  m->streamCount = m->streamCap = 0;
+  m->refs = 1;
+  m->eof = false;
+  SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  pthread_create(&m->demux, NULL, tlsMuxDemux, m);
+  return m;
+}
+
+// Returns true if this was the last stream, and the caller should now shut
+//   down the connection itself.
+static bool tlsMuxRelease(tlsMux* m){
+  pthread_mutex_lock(&m->lock);
+  bool last = (--m->refs == 0);
+  pthread_mutex_unlock(&m->lock);
+  if(!last) return false;
+  char c = 0;
+  if(write(m->wakefd[1], &c, 1) < 0) perror("TLS mux wakeup: ");
+  pthread_join(m->demux, NULL);
+  fcntl(m->sock, F_SETFL, fcntl(m->sock, F_GETFL) & ~O_NONBLOCK);
+  close(m->wakefd[0]);
+  close(m->wakefd[1]);
+  size_t i;
+  for(i = 0; i < m->streamCount; i++){
+    tlsMuxChunk *c = m->streams[i].head, *t;
+    while(c){ t = c->next; free(c); c = t; }
+  }
+  free(m->streams);
+  pthread_mutex_destroy(&m->ssl_lock);
+  pthread_mutex_destroy(&m->write_lock);
+  pthread_mutex_destroy(&m->lock);
+  pthread_cond_destroy(&m->cond);
+  free(m);
+  return true;
+}
+
 typedef struct tls2PTransport
 { ProtocolTransport cb;
   int sock;
@@ -388,17 +770,118 @@ typedef struct tls2PTransport
   unsigned char *ssl_buffer;
   size_t ssl_buffer_index;
   size_t ssl_buffer_size;
+
+  // Read-ahead: bytes [recv_buffer_start, recv_buffer_end) are received but
+  //   not yet consumed. Unused if recv_buffer_size is 0.
+  unsigned char *recv_buffer;
+  size_t recv_buffer_start, recv_buffer_end;
+  size_t recv_buffer_size;
+
+  // Async mode: a sender thread owns SSL_write. ssl_buffer is filled by the
+  //   protocol thread, while async_buffer is being written out.
+  bool async;
+  pthread_t async_thread;
+  pthread_mutex_t async_lock;
+  pthread_cond_t async_cond;
+  unsigned char *async_buffer;
+  size_t async_len;
+  bool async_pending, async_stop;
+  int async_error;
+
+  // kTLS: record encryption is done by the kernel. ktls is what was
+  //   requested, ktls_send whether the kernel actually took over (it falls
+  //   back to OpenSSL's record layer when the tls ULP is unavailable).
+  bool ktls, ktls_send;
+  char* ciphersuites; // NULL for the context default
+
+  // Set if splits are multiplexed over this connection. Every transport
+  //   sharing the mux then shares sock and ssl_socket as well.
+  tlsMux* mux;
+  uint64_t stream_id;
+  uint64_t splitCount;
 } tls2PTransport;
 
 // Profiling output
 size_t tls2PBytesSent(ProtocolDesc* pd) { return ((tls2PTransport*)(pd->trans))->bytes; }
 size_t tls2PFlushCount(ProtocolDesc* pd) { return ((tls2PTransport*)(pd->trans))->flushCount; }
+bool tls2PUsesKtls(ProtocolDesc* pd) { return ((tls2PTransport*)(pd->trans))->ktls_send; }
+
+static int tls2PWriteAll(tls2PTransport* tlst, const char* s, size_t n){
+  size_t n2 = 0;
+  if(tlst->mux) return tlsMuxWrite(tlst->mux, tlst->stream_id, s, n);
+  while(n > n2){
+    // With kTLS, plaintext written to the socket is encrypted by the kernel
+    ssize_t res = tlst->ktls_send
+                ? send(tlst->sock, s + n2, n - n2, MSG_NOSIGNAL)
+                : SSL_write(tlst->ssl_socket, s + n2, n - n2);
+    if(res < 0 && tlst->ktls_send && errno == EINTR) continue;
+    if(res <= 0) { perror("TLS write error: "); return -1; }
+    n2 += res;
+  }
+  return n2;
+}
+
+static void* tls2PAsyncSender(void* va){
+  tls2PTransport* tlst = va;
+  pthread_mutex_lock(&tlst->async_lock);
+  while(true){
+    while(!tlst->async_pending && !tlst->async_stop)
+      pthread_cond_wait(&tlst->async_cond, &tlst->async_lock);
+    if(!tlst->async_pending) break; // stopped, and nothing left to write
+    pthread_mutex_unlock(&tlst->async_lock);
+    int res = tls2PWriteAll(tlst, (char*)tlst->async_buffer, tlst->async_len);
+    pthread_mutex_lock(&tlst->async_lock);
+    if(res < 0) tlst->async_error = res;
+    tlst->async_pending = false;
+    pthread_cond_broadcast(&tlst->async_cond);
+  }
+  pthread_mutex_unlock(&tlst->async_lock);
+  return NULL;
+}
+
+// Hands the filled ssl_buffer over to the sender thread, and takes its
+//   (already written) buffer in exchange. Blocks if the sender is still busy.
+static int tls2PAsyncHandOff(tls2PTransport* tlst, bool wait){
+  int err;
+  pthread_mutex_lock(&tlst->async_lock);
+  while(tlst->async_pending)
+    pthread_cond_wait(&tlst->async_cond, &tlst->async_lock);
+  if(tlst->ssl_buffer_index != 0){
+    unsigned char *t = tlst->async_buffer;
+    tlst->async_buffer = tlst->ssl_buffer;
+    tlst->async_len = tlst->ssl_buffer_index;
+    tlst->ssl_buffer = t;
+    tlst->ssl_buffer_index = 0;
+    tlst->async_pending = true;
+    pthread_cond_broadcast(&tlst->async_cond);
+  }
+  if(wait) while(tlst->async_pending)
+    pthread_cond_wait(&tlst->async_cond, &tlst->async_lock);
+  err = tlst->async_error;
+  pthread_mutex_unlock(&tlst->async_lock);
+  return err;
+}
+
+static int tls2PSendAsync(tls2PTransport* tlst, const void* s, size_t n){
+  size_t n2 = 0;
+  while(n > n2){
+    size_t k = tlst->ssl_buffer_size - tlst->ssl_buffer_index;
+    if(k > n - n2) k = n - n2;
+    memcpy(tlst->ssl_buffer + tlst->ssl_buffer_index, ((const char*)s) + n2, k);
+    tlst->ssl_buffer_index += k;
+    n2 += k;
+    if(tlst->ssl_buffer_index == tlst->ssl_buffer_size
+        && tls2PAsyncHandOff(tlst, false) < 0) return -1;
+  }
+  return n2;
+}
 
 static int tls2PSend(ProtocolTransport* pt, int dest, const void* s, size_t n){
   struct tls2PTransport* tlst = CAST(pt);
   size_t n2 = 0;
 
   tlst->needFlush = true;
+  if(tlst->async) return tls2PSendAsync(tlst, s, n);
 
   size_t available_space_in_buffer = tlst->ssl_buffer_size - tlst->ssl_buffer_index;
   if(tlst->ssl_buffer_size != 0 && available_space_in_buffer >= n){
@@ -408,24 +891,13 @@ static int tls2PSend(ProtocolTransport* pt, int dest, const void* s, size_t n){
 
     n2 = n;
   }else{
-	  if(tlst->ssl_buffer_size != 0){
-      size_t n2_buffer = 0;
-      size_t n_buffer = tlst->ssl_buffer_index;
-
-      while(n_buffer > n2_buffer){
-        int res = SSL_write(tlst->ssl_socket, ((char*)(tlst->ssl_buffer)) + n2_buffer, n_buffer - n2_buffer);
-        if(res < 0) { perror("TLS write error: "); return res;}
-        n2_buffer += res;
-    	}
-
-	     tlst->ssl_buffer_index = 0;
-	  }
-
-  	while(n > n2){
-  	  int res = SSL_write(tlst->ssl_socket, ((char*)s) + n2, n - n2);
-  	  if(res < 0) { perror("TLS write error: "); return res; }
-  	  n2 += res;
-  	}
+    if(tlst->ssl_buffer_size != 0){
+      if(tls2PWriteAll(tlst, (char*)tlst->ssl_buffer, tlst->ssl_buffer_index) < 0)
+        return -1;
+      tlst->ssl_buffer_index = 0;
+    }
+    if(tls2PWriteAll(tlst, s, n) < 0) return -1;
+    n2 = n;
   }
 
   return n2;
@@ -438,6 +910,34 @@ static int tls2PSendProfiled(ProtocolTransport* pt, int dest, const void* s, siz
   return res;
 }
 
+// Serves small reads from recv_buffer, and refills it with whatever a single
+//   SSL_read returns (up to one record), so we never wait for more data
+//   than the caller asked for. Large reads bypass the buffer.
+static int tls2PRecvBuffered(tls2PTransport* tlst, char* s, size_t n){
+  size_t n2 = 0;
+  while(n > n2){
+    size_t avail = tlst->recv_buffer_end - tlst->recv_buffer_start;
+    if(avail == 0){
+      int res;
+      if(n - n2 >= tlst->recv_buffer_size){
+        res = SSL_read(tlst->ssl_socket, s + n2, n - n2);
+        if(res <= 0) { perror("TLS read error: "); return -1; }
+        n2 += res;
+        continue;
+      }
+      res = SSL_read(tlst->ssl_socket, tlst->recv_buffer, tlst->recv_buffer_size);
+      if(res <= 0) { perror("TLS read error: "); return -1; }
+      tlst->recv_buffer_start = 0;
+      tlst->recv_buffer_end = avail = res;
+    }
+    size_t k = (avail > n - n2 ? n - n2 : avail);
+    memcpy(s + n2, tlst->recv_buffer + tlst->recv_buffer_start, k);
+    tlst->recv_buffer_start += k;
+    n2 += k;
+  }
+  return n2;
+}
+
 static int tls2PRecv(ProtocolTransport* pt, int src, void* s, size_t n){
   struct tls2PTransport* tlst = CAST(pt);
   int res = 0, n2 = 0;
@@ -445,6 +945,8 @@ static int tls2PRecv(ProtocolTransport* pt, int src, void* s, size_t n){
     transFlush(pt);
     tlst->needFlush = false;
   }
+  if(tlst->mux) return tlsMuxRead(tlst->mux, tlst->stream_id, s, n);
+  if(tlst->recv_buffer_size) return tls2PRecvBuffered(tlst, s, n);
 
   while(n > n2) {
     res = SSL_read(tlst->ssl_socket, ((char*)s) + n2, n - n2);
@@ -460,19 +962,17 @@ static int tls2PRecv(ProtocolTransport* pt, int src, void* s, size_t n){
 static int tls2PFlush(ProtocolTransport* pt){
   struct tls2PTransport* tlst = CAST(pt);
 
-  if(tlst->ssl_buffer_index != 0){
-	size_t n2_buffer = 0;
-        size_t n_buffer = tlst->ssl_buffer_index;
-
-        while(n_buffer > n2_buffer){
-                int res = SSL_write(tlst->ssl_socket, ((char*)(tlst->ssl_buffer)) + n2_buffer, n_buffer - n2_buffer);
-                if(res < 0) { perror("TLS write error: "); return res;}
-                n2_buffer += res;
-        }
-
-        tlst->ssl_buffer_index = 0;
+  // Barrier: returns only after the sender thread has written everything,
+  //   so the caller is free to use the SSL object again (e.g. SSL_read)
+  if(tlst->async){
+    if(tls2PAsyncHandOff(tlst, true) < 0) return -1;
+  }else if(tlst->ssl_buffer_index != 0){
+    if(tls2PWriteAll(tlst, (char*)tlst->ssl_buffer, tlst->ssl_buffer_index) < 0)
+      return -1;
+    tlst->ssl_buffer_index = 0;
   }
 
+  if(tlst->mux) return 0; // frames go out as they are written
   return BIO_flush(SSL_get_wbio(tlst->ssl_socket));
 }
 
@@ -484,12 +984,28 @@ static int tls2PFlushProfiled(ProtocolTransport* pt){
 
 static void tls2PCleanup(ProtocolTransport* pt){
   struct tls2PTransport* tlst = CAST(pt);
-  BIO_flush(SSL_get_wbio(tlst->ssl_socket));
-  if(!tlst->keepAlive){
-    SSL_shutdown(tlst->ssl_socket);
-    close(tlst->sock);
+  tls2PFlush(pt);
+  if(tlst->async){
+    pthread_mutex_lock(&tlst->async_lock);
+    tlst->async_stop = true;
+    pthread_cond_broadcast(&tlst->async_cond);
+    pthread_mutex_unlock(&tlst->async_lock);
+    pthread_join(tlst->async_thread, NULL);
+    pthread_mutex_destroy(&tlst->async_lock);
+    pthread_cond_destroy(&tlst->async_cond);
+    free(tlst->async_buffer);
+  }
+  // with a mux, only the last stream to go shuts down the connection
+  if(tlst->mux == NULL || tlsMuxRelease(tlst->mux)){
+    if(!tlst->keepAlive){
+      SSL_shutdown(tlst->ssl_socket);
+      close(tlst->sock);
+    }
+    SSL_free(tlst->ssl_socket);
   }
-  SSL_free(tlst->ssl_socket);
+  free(tlst->ssl_buffer);
+  free(tlst->recv_buffer);
+  free(tlst->ciphersuites);
   free(pt);
 }
 
@@ -509,13 +1025,13 @@ static const tls2PTransport tls2PTransportTemplate
   = {{.maxParties = 2, .split = tls2PSplit, .send = tls2PSend, .recv = tls2PRecv, .flush = tls2PFlush,
       .cleanup = tls2PCleanup},
      .sock = 0, .isClient = 0, .needFlush = false, .bytes = 0, .flushCount = 0,
-     .parent = NULL, .ssl_ctx = NULL, .ssl_socket = NULL};
+     .parent = NULL, .ssl_ctx = NULL, .ssl_socket = NULL, .async = false};
 
 static const tls2PTransport tls2PProfiledTransportTemplate
   = {{.maxParties = 2, .split = tls2PSplit, .send = tls2PSendProfiled, .recv = tls2PRecv,
      .flush = tls2PFlushProfiled, .cleanup = tls2PCleanupProfiled},
      .sock = 0, .isClient = 0, .needFlush = false, .bytes = 0, .flushCount = 0,
-     .parent = NULL, .ssl_ctx = NULL, .ssl_socket = NULL};
+     .parent = NULL, .ssl_ctx = NULL, .ssl_socket = NULL, .async = false};
 
 /*
 * Using the code from https://github.com/okba-zoueghi/tls_examples
@@ -524,8 +1040,9 @@ static const tls2PTransport tls2PProfiledTransportTemplate
 #define TLS_LOG_ERROR(msg) printf("[TLS ERROR] : %s\n", msg)
 #define TLS_LOG_INFO(msg) printf("[TLS INFO] : %s\n", msg)
 
-#define TLS_AES_128_GCM_SHA256_BYTES  ((const unsigned char *)"\x13\x01")
+#define TLS_DEFAULT_CIPHERSUITE "TLS_AES_128_GCM_SHA256"
 #define TLS_EX_DATA_INDEX_OTHER_PARTY_IP 1
+#define TLS_EX_DATA_INDEX_EXTERNAL_PSK 2
 
 /*
 * For every initialization of protocol using protocolConnectSSL2P or protocolConnectSSL2P,
@@ -538,6 +1055,7 @@ typedef struct _tls_key_dictionary {
   struct _tls_key_dictionary *next;
   char identity[40];
   unsigned char key[16];
+  SSL_SESSION *session; // latest resumption ticket from this server, if any
 } tls_key_dictionary;
 
 tls_key_dictionary *tls_key_dictionary_head = NULL;
@@ -547,17 +1065,22 @@ void tls_set_my_identity(const char* my_identity){
 	strcpy(tls_my_identity, my_identity);
 }
 
-unsigned char* tls_key_dictionary_search(tls_key_dictionary *head, const char *target_identity){
+static tls_key_dictionary* tls_key_dictionary_find(tls_key_dictionary *head, const char *target_identity){
   tls_key_dictionary *cur = head;
   while(cur != NULL) {
     if(strcmp(cur->identity, target_identity) == 0){
-      return cur->key;
+      return cur;
     }
     cur = cur->next;
   }
   return NULL;
 }
 
+unsigned char* tls_key_dictionary_search(tls_key_dictionary *head, const char *target_identity){
+  tls_key_dictionary *entry = tls_key_dictionary_find(head, target_identity);
+  return entry == NULL ? NULL : entry->key;
+}
+
 tls_key_dictionary* tls_key_dictionary_insert(tls_key_dictionary *head, const char *new_identity, const unsigned char *new_key){
 	if(tls_key_dictionary_search(head, new_identity) != NULL){
     return head;
@@ -570,10 +1093,47 @@ tls_key_dictionary* tls_key_dictionary_insert(tls_key_dictionary *head, const ch
 	  new_head->next = head;
 	  strcpy(new_head->identity, new_identity);
 	  memcpy(new_head->key, new_key, 16);
+	  new_head->session = NULL;
 	  return new_head;
 	}
 }
 
+// The external PSK session is bound to the first TLS 1.3 suite enabled on
+//   this connection (see tls_set_ciphersuites).
+static const SSL_CIPHER* tls_psk_cipher(SSL *ssl){
+  STACK_OF(SSL_CIPHER) *ciphers = SSL_get_ciphers(ssl);
+  int i;
+  for(i = 0; i < sk_SSL_CIPHER_num(ciphers); i++){
+    const SSL_CIPHER *c = sk_SSL_CIPHER_value(ciphers, i);
+    if(strcmp(SSL_CIPHER_get_version(c), "TLSv1.3") == 0) return c;
+  }
+  return NULL;
+}
+
+// OpenSSL silently drops suite names it does not know (e.g. the
+//   integrity-only TLS_SHA256_SHA256 before OpenSSL 3.4), so check that a
+//   usable suite is left. Integrity-only suites have 0 security bits, which
+//   the default security level 1 rejects in the handshake, so the level is
+//   lowered to 0 for this connection only if one of those is enabled.
+static bool tls_set_ciphersuites(SSL *ssl, const char *suites){
+  STACK_OF(SSL_CIPHER) *ciphers;
+  int i;
+  if(!SSL_set_ciphersuites(ssl, suites) || tls_psk_cipher(ssl) == NULL){
+    fprintf(stderr, "[TLS ERROR] : Cipher suite \"%s\" is not supported by this OpenSSL\n", suites);
+    return false;
+  }
+  ciphers = SSL_get_ciphers(ssl);
+  for(i = 0; i < sk_SSL_CIPHER_num(ciphers); i++){
+    const SSL_CIPHER *c = sk_SSL_CIPHER_value(ciphers, i);
+    if(strcmp(SSL_CIPHER_get_version(c), "TLSv1.3") == 0
+       && SSL_CIPHER_get_bits(c, NULL) == 0){
+      SSL_set_security_level(ssl, 0);
+      break;
+    }
+  }
+  return true;
+}
+
 int tls_psk_server_callback(SSL *ssl, const unsigned char *identity, size_t identity_len, SSL_SESSION **sess){
 	char identity_end_with_zero[identity_len + 1];
 	memset(identity_end_with_zero, 0, identity_len + 1);
@@ -581,15 +1141,18 @@ int tls_psk_server_callback(SSL *ssl, const unsigned char *identity, size_t iden
 
   //printf("Someone asks me for a key for the identity %s\n", identity_end_with_zero);
 
-	const unsigned char *found_key = tls_key_dictionary_search(tls_key_dictionary_head, identity);
+	const unsigned char *found_key = tls_key_dictionary_search(tls_key_dictionary_head, identity_end_with_zero);
 
+  // Not a known client: the identity may be a session ticket, which
+  //   OpenSSL tries to decrypt next. Only a handshake with no usable identity
+  //   at all fails.
   if(found_key == NULL) {
-    TLS_LOG_ERROR("Failed to find the key for this client (IP address)");
-    return 0;
+    *sess = NULL;
+    return 1;
   }
 
 	SSL_SESSION *newsess = SSL_SESSION_new();
-	const SSL_CIPHER *cipher = SSL_CIPHER_find(ssl, TLS_AES_128_GCM_SHA256_BYTES);
+	const SSL_CIPHER *cipher = tls_psk_cipher(ssl);
 
 	if(newsess == NULL
 		|| cipher == NULL
@@ -601,6 +1164,7 @@ int tls_psk_server_callback(SSL *ssl, const unsigned char *identity, size_t iden
 	}
 
 	*sess = newsess;
+  SSL_set_ex_data(ssl, TLS_EX_DATA_INDEX_EXTERNAL_PSK, (void*)1);
 
   return 1;
 }
@@ -628,7 +1192,7 @@ int tls_psk_client_callback(SSL *ssl, const EVP_MD *md, const unsigned char **id
   *idlen = strlen(tls_my_identity);
 
   SSL_SESSION *newsess = SSL_SESSION_new();
-	const SSL_CIPHER *cipher = SSL_CIPHER_find(ssl, TLS_AES_128_GCM_SHA256_BYTES);
+	const SSL_CIPHER *cipher = tls_psk_cipher(ssl);
 
 	if(newsess == NULL
 		|| cipher == NULL
@@ -644,6 +1208,61 @@ int tls_psk_client_callback(SSL *ssl, const EVP_MD *md, const unsigned char **id
   return 1;
 }
 
+// Client-side cache of resumption tickets, one per server identity. Tickets
+//   arrive on whichever thread reads the connection, hence the lock.
+static pthread_mutex_t tls_session_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t tls_full_handshakes = 0, tls_resumed_handshakes = 0;
+
+static int tls_new_session_callback(SSL *ssl, SSL_SESSION *sess){
+  const char *server_identity = SSL_get_ex_data(ssl, TLS_EX_DATA_INDEX_OTHER_PARTY_IP);
+  if(server_identity == NULL) return 0;
+  pthread_mutex_lock(&tls_session_lock);
+  tls_key_dictionary *entry = tls_key_dictionary_find(tls_key_dictionary_head, server_identity);
+  if(entry != NULL){
+    if(entry->session != NULL) SSL_SESSION_free(entry->session);
+    entry->session = sess;
+  }
+  pthread_mutex_unlock(&tls_session_lock);
+  return entry != NULL; // 1 means we keep the reference
+}
+
+// Offers the cached ticket, if any. The external PSK is still offered after
+//   it, so an expired or unknown ticket just means a full handshake.
+static void tls_offer_cached_session(SSL *ssl){
+  const char *server_identity = SSL_get_ex_data(ssl, TLS_EX_DATA_INDEX_OTHER_PARTY_IP);
+  if(server_identity == NULL) return;
+  pthread_mutex_lock(&tls_session_lock);
+  tls_key_dictionary *entry = tls_key_dictionary_find(tls_key_dictionary_head, server_identity);
+  if(entry != NULL && entry->session != NULL
+      && SSL_SESSION_is_resumable(entry->session))
+    SSL_set_session(ssl, entry->session);
+  pthread_mutex_unlock(&tls_session_lock);
+}
+
+// OpenSSL reports any PSK handshake as reused. A server used the external
+//   key iff its find-session callback matched it; a client resumed iff the
+//   session it ended up with carries a ticket.
+static bool tls_handshake_resumed(SSL *ssl){
+  if(!SSL_session_reused(ssl)) return false;
+  if(SSL_is_server(ssl)) return SSL_get_ex_data(ssl, TLS_EX_DATA_INDEX_EXTERNAL_PSK) == NULL;
+  return SSL_SESSION_has_ticket(SSL_get0_session(ssl));
+}
+
+static void tls_count_handshake(SSL *ssl){
+  bool resumed = tls_handshake_resumed(ssl);
+  pthread_mutex_lock(&tls_session_lock);
+  if(resumed) tls_resumed_handshakes++;
+  else tls_full_handshakes++;
+  pthread_mutex_unlock(&tls_session_lock);
+}
+
+void tls2PHandshakeCounts(size_t* full, size_t* resumed){
+  pthread_mutex_lock(&tls_session_lock);
+  *full = tls_full_handshakes;
+  *resumed = tls_resumed_handshakes;
+  pthread_mutex_unlock(&tls_session_lock);
+}
+
 void tls_library_init(){
   static int init_done = 0;
 
@@ -671,7 +1290,7 @@ SSL_CTX* tls_server_get_ctx(){
       exit(EXIT_FAILURE);
     }
 
-    if(!SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256")) {
+    if(!SSL_CTX_set_ciphersuites(ctx, TLS_DEFAULT_CIPHERSUITE)) {
       TLS_LOG_ERROR("Failed to set cipher suite for TLS");
       exit(EXIT_FAILURE);
     }
@@ -698,12 +1317,14 @@ SSL_CTX* tls_client_get_ctx(){
       exit(EXIT_FAILURE);
     }
 
-    if(!SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256")) {
+    if(!SSL_CTX_set_ciphersuites(ctx, TLS_DEFAULT_CIPHERSUITE)) {
       TLS_LOG_ERROR("Failed to set cipher suite for TLS");
       exit(EXIT_FAILURE);
     }
 
     SSL_CTX_set_psk_use_session_callback(ctx, tls_psk_client_callback);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, tls_new_session_callback);
   }
 
   return ctx;
@@ -728,6 +1349,14 @@ static tls2PTransport* tls2PNew(int sock, SSL_CTX *ssl_ctx, SSL *ssl_socket, boo
   // For the server, during the connection phase, these two will be NULL.
   trans->ssl_ctx = ssl_ctx;
   trans->ssl_socket = ssl_socket;
+  trans->ktls = trans->ktls_send = false;
+  trans->ciphersuites = NULL;
+  trans->keepAlive = false;
+  trans->mux = NULL;
+  trans->stream_id = trans->splitCount = 0;
+  trans->recv_buffer = NULL;
+  trans->recv_buffer_start = trans->recv_buffer_end = 0;
+  trans->recv_buffer_size = 0;
 
   if(buffer_size != 0){
     trans->ssl_buffer = malloc(sizeof(char) * (buffer_size + 100));
@@ -742,6 +1371,45 @@ static tls2PTransport* tls2PNew(int sock, SSL_CTX *ssl_ctx, SSL *ssl_socket, boo
   return trans;
 }
 
+// Asks OpenSSL to install the traffic keys into the kernel once the handshake
+//   completes. Has to be called before SSL_do_handshake.
+static void tls2PRequestKtls(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+static void tls2PCheckKtls(tls2PTransport* trans) {
+  trans->ktls = true;
+  trans->ktls_send = BIO_get_ktls_send(SSL_get_wbio(trans->ssl_socket)) == 1;
+}
+
+#define TLS_ASYNC_DEFAULT_BUFFER_SIZE 32768
+
+// Muxed streams already read from memory, so they do not need this.
+static void tls2PSetRecvBuffer(tls2PTransport* trans, size_t size) {
+  if(size == 0 || trans->mux) return;
+  trans->recv_buffer = malloc(size);
+  trans->recv_buffer_size = size;
+}
+
+// Moves all future SSL_write calls to a background thread. Must be called
+// before anything is sent on this transport.
+static void tls2PStartAsync(tls2PTransport* trans) {
+  if(trans->ssl_buffer_size == 0){
+    trans->ssl_buffer = malloc(TLS_ASYNC_DEFAULT_BUFFER_SIZE);
+    trans->ssl_buffer_size = TLS_ASYNC_DEFAULT_BUFFER_SIZE;
+  }
+  trans->async_buffer = malloc(trans->ssl_buffer_size);
+  trans->async_len = 0;
+  trans->async_pending = trans->async_stop = false;
+  trans->async_error = 0;
+  pthread_mutex_init(&trans->async_lock, NULL);
+  pthread_cond_init(&trans->async_cond, NULL);
+  trans->async = true;
+  pthread_create(&trans->async_thread, NULL, tls2PAsyncSender, trans);
+}
+
 void protocolUseTLS2P(ProtocolDesc* pd, int sock, SSL_CTX *shared_ssl_ctx, SSL *ssl_socket, bool isClient, bool isProfiled, size_t buffer_size) {
   pd->trans = &tls2PNew(sock, shared_ssl_ctx, ssl_socket, isClient, isProfiled, buffer_size)->cb;
   tls2PTransport* tlst = CAST(pd->trans);
@@ -754,7 +1422,7 @@ void protocolUseTLS2PKeepAlive(ProtocolDesc* pd, int sock, SSL_CTX *shared_ssl_c
   tlst->keepAlive = true;
 }
 
-int protocolConnectTLS2P(ProtocolDesc* pd, const char* server, const char* port, const unsigned char *key, bool isProfiled, size_t buffer_size) {
+int protocolConnectTLS2PEx(ProtocolDesc* pd, const char* server, const char* port, const unsigned char *key, const TLS2POptions* opt) {
   struct sockaddr_in sa;
   if(getsockaddr(server, port, (struct sockaddr*)&sa) < 0) return -1; // dns error
   int sock = tcpConnect(&sa); if(sock < 0) return -1;
@@ -788,6 +1456,11 @@ int protocolConnectTLS2P(ProtocolDesc* pd, const char* server, const char* port,
   tls_library_init();
   SSL_CTX * ctx = tls_client_get_ctx();
   SSL *ssl = SSL_new(ctx);
+  if(opt->ciphersuites != NULL && !tls_set_ciphersuites(ssl, opt->ciphersuites)){
+    SSL_free(ssl);
+    close(sock);
+    return -1;
+  }
 
   SSL_set_ex_data(ssl, TLS_EX_DATA_INDEX_OTHER_PARTY_IP, server_identity_to_store);
 
@@ -825,6 +1498,8 @@ int protocolConnectTLS2P(ProtocolDesc* pd, const char* server, const char* port,
 
   SSL_set_fd(ssl, sock);
   SSL_set_connect_state(ssl);
+  tls_offer_cached_session(ssl);
+  if(opt->ktls) tls2PRequestKtls(ssl);
 
   int error = SSL_do_handshake(ssl);
   if(error != 1){
@@ -840,12 +1515,23 @@ int protocolConnectTLS2P(ProtocolDesc* pd, const char* server, const char* port,
 
     return -1;
   }
-
-  protocolUseTLS2P(pd, sock, ctx, ssl, true, isProfiled, buffer_size);
+  tls_count_handshake(ssl);
+
+  protocolUseTLS2P(pd, sock, ctx, ssl, true, opt->isProfiled, opt->buffer_size);
+  if(opt->mux_splits) ((tls2PTransport*)pd->trans)->mux = tlsMuxNew(ssl, sock);
+  tls2PSetRecvBuffer(CAST(pd->trans), opt->recv_buffer_size);
+  if(opt->ciphersuites) ((tls2PTransport*)pd->trans)->ciphersuites = strdup(opt->ciphersuites);
+  if(opt->ktls) tls2PCheckKtls(CAST(pd->trans));
+  if(opt->async_send) tls2PStartAsync(CAST(pd->trans));
   return 0;
 }
 
-int protocolAcceptTLS2P(ProtocolDesc* pd, const char* port, const unsigned char *key, bool isProfiled, size_t buffer_size) {
+int protocolConnectTLS2P(ProtocolDesc* pd, const char* server, const char* port, const unsigned char *key, bool isProfiled, size_t buffer_size) {
+  TLS2POptions opt = {.isProfiled = isProfiled, .buffer_size = buffer_size};
+  return protocolConnectTLS2PEx(pd, server, port, key, &opt);
+}
+
+int protocolAcceptTLS2PEx(ProtocolDesc* pd, const char* port, const unsigned char *key, const TLS2POptions* opt) {
   int listenSock, sock;
   listenSock = tcpListenAny(port);
   if((sock = accept(listenSock, 0, 0)) < 0) return -1;
@@ -876,6 +1562,12 @@ int protocolAcceptTLS2P(ProtocolDesc* pd, const char* port, const unsigned char
   tls_library_init();
   SSL_CTX * ctx = tls_server_get_ctx();
   SSL *ssl = SSL_new(ctx);
+  if(opt->ciphersuites != NULL && !tls_set_ciphersuites(ssl, opt->ciphersuites)){
+    SSL_free(ssl);
+    close(sock);
+    close(listenSock);
+    return -1;
+  }
 
   BIO* rbio_with_buf = BIO_new(BIO_s_bio());
   BIO* wbio_with_buf = BIO_new(BIO_s_bio());
@@ -911,6 +1603,7 @@ int protocolAcceptTLS2P(ProtocolDesc* pd, const char* port, const unsigned char
 
   SSL_set_fd(ssl, sock);
   SSL_set_accept_state(ssl);
+  if(opt->ktls) tls2PRequestKtls(ssl);
 
   int error = SSL_do_handshake(ssl);
   if(error != 1){
@@ -926,15 +1619,43 @@ int protocolAcceptTLS2P(ProtocolDesc* pd, const char* port, const unsigned char
 
     return -1;
   }
-  
-  protocolUseTLS2P(pd, sock, ctx, ssl, false, isProfiled, buffer_size);
+  tls_count_handshake(ssl);
+
+  protocolUseTLS2P(pd, sock, ctx, ssl, false, opt->isProfiled, opt->buffer_size);
+  if(opt->mux_splits) ((tls2PTransport*)pd->trans)->mux = tlsMuxNew(ssl, sock);
+  tls2PSetRecvBuffer(CAST(pd->trans), opt->recv_buffer_size);
+  if(opt->ciphersuites) ((tls2PTransport*)pd->trans)->ciphersuites = strdup(opt->ciphersuites);
+  if(opt->ktls) tls2PCheckKtls(CAST(pd->trans));
+  if(opt->async_send) tls2PStartAsync(CAST(pd->trans));
   close(listenSock);
   return 0;
 }
 
+int protocolAcceptTLS2P(ProtocolDesc* pd, const char* port, const unsigned char *key, bool isProfiled, size_t buffer_size) {
+  TLS2POptions opt = {.isProfiled = isProfiled, .buffer_size = buffer_size};
+  return protocolAcceptTLS2PEx(pd, port, key, &opt);
+}
+
+static ProtocolTransport* tls2PSplitMux(tls2PTransport* tlst){
+  tls2PTransport* tnew = tls2PNew(tlst->sock, tlst->ssl_ctx, tlst->ssl_socket,
+                                  tlst->isClient, tlst->isProfiled, tlst->ssl_buffer_size);
+  tnew->parent = tlst;
+  tnew->ktls = tlst->ktls;
+  tnew->ktls_send = tlst->ktls_send;
+  pthread_mutex_lock(&tlst->mux->lock);
+  tlst->mux->refs++;
+  pthread_mutex_unlock(&tlst->mux->lock);
+  tnew->mux = tlst->mux;
+  tnew->stream_id = tlsMuxChildId(tlst->stream_id, ++tlst->splitCount);
+  if(tlst->async) tls2PStartAsync(tnew);
+  return CAST(tnew);
+}
+
 static ProtocolTransport* tls2PSplit(ProtocolTransport* tsrc){
   tls2PTransport* tlst = CAST(tsrc);
+  // the other party may be waiting on us before it splits too
   transFlush(tsrc);
+  if(tlst->mux) return tls2PSplitMux(tlst);
 
   // duplicate the TCP socket, now need to establish the SSL connection over it.
   int newsock = sockSplit(tlst->sock, tsrc, tlst->isClient);
@@ -946,6 +1667,11 @@ static ProtocolTransport* tls2PSplit(ProtocolTransport* tsrc){
   SSL *ssl;
   tls_library_init();
   ssl = SSL_new(tlst->ssl_ctx);
+  if(tlst->ciphersuites != NULL && !tls_set_ciphersuites(ssl, tlst->ciphersuites)){
+    SSL_free(ssl);
+    close(newsock);
+    return NULL;
+  }
 
   if(tlst->isClient){
     SSL_set_ex_data(ssl, TLS_EX_DATA_INDEX_OTHER_PARTY_IP, SSL_get_ex_data(tlst->ssl_socket, TLS_EX_DATA_INDEX_OTHER_PARTY_IP));
@@ -963,6 +1689,10 @@ static ProtocolTransport* tls2PSplit(ProtocolTransport* tsrc){
       printf("An error in the queue: %s\n", ERR_error_string(err_in_queue, error_string));
     }
 
+    BIO_free(rbio_with_buf);
+    BIO_free(wbio_with_buf);
+    SSL_free(ssl);
+    close(newsock);
     return NULL;
   }
 
@@ -978,6 +1708,10 @@ static ProtocolTransport* tls2PSplit(ProtocolTransport* tsrc){
       printf("An error in the queue: %s\n", ERR_error_string(err_in_queue, error_string));
     }
 
+    BIO_free(rbio_with_buf);
+    BIO_free(wbio_with_buf);
+    SSL_free(ssl);
+    close(newsock);
     return NULL;
   }
   SSL_set_bio(ssl, rbio_with_buf, wbio_with_buf);
@@ -986,9 +1720,11 @@ static ProtocolTransport* tls2PSplit(ProtocolTransport* tsrc){
 
   if(tlst->isClient){
     SSL_set_connect_state(ssl);
+    tls_offer_cached_session(ssl);
   }else{
     SSL_set_accept_state(ssl);
   }
+  if(tlst->ktls) tls2PRequestKtls(ssl);
 
   int handshake_error_code  = SSL_do_handshake(ssl);
   if(handshake_error_code != 1){
@@ -1001,55 +1737,827 @@ static ProtocolTransport* tls2PSplit(ProtocolTransport* tsrc){
     while(err_in_queue = ERR_get_error()){
       printf("An error in the queue: %s\n", ERR_error_string(err_in_queue, error_string));
     }
-
-    return NULL;
+
+    SSL_free(ssl);
+    close(newsock);
+    return NULL;
+  }
+  tls_count_handshake(ssl);
+
+  tls2PTransport* tnew = tls2PNew(newsock, tlst->ssl_ctx, ssl, tlst->isClient, tlst->isProfiled, tlst->ssl_buffer_size);
+  tnew->parent = tlst;
+  if(tlst->ciphersuites) tnew->ciphersuites = strdup(tlst->ciphersuites);
+  tls2PSetRecvBuffer(tnew, tlst->recv_buffer_size);
+  if(tlst->ktls) tls2PCheckKtls(tnew);
+  if(tlst->async) tls2PStartAsync(tnew);
+  return CAST(tnew);
+}
+
+// --------------------------- Shared memory trans ---------------------------
+
+// For two parties on the same host (or containers sharing a tmpfs). Both
+//   processes map one file, which holds a lock-free single-producer
+//   single-consumer ring per direction. Ring indices only ever grow, and are
+//   reduced modulo SHM_RING_SIZE on access. The file is named after a
+//   session id both parties agree on, so neither can pick up a file left
+//   over from another run. The creator makes the file and waits for the
+//   other party to map it, then unlinks it; on timeout it unlinks it anyway.
+#define SHM_MAGIC 0x326d6873766c626fULL
+#define SHM_RING_SIZE (1<<20)
+#define SHM_CACHE_LINE 64
+#define SHM_JOIN_TIMEOUT 60 // seconds either side waits for the other
+
+typedef struct
+{ uint64_t head; // written by the producer only
+  char pad1[SHM_CACHE_LINE-sizeof(uint64_t)];
+  uint64_t tail; // written by the consumer only
+  char pad2[SHM_CACHE_LINE-sizeof(uint64_t)];
+  unsigned char data[SHM_RING_SIZE];
+} shmRing;
+
+typedef struct
+{ uint64_t magic;
+  uint32_t closed[2]; // closed[i]: side i has cleaned up
+  uint32_t joined;    // set once the other side has mapped the file
+  char pad[SHM_CACHE_LINE-2*sizeof(uint64_t)-sizeof(uint32_t)];
+  shmRing ring[2];    // ring[i] is written by side i
+} shmRegion;
+
+typedef struct shm2PTransport
+{ ProtocolTransport cb;
+  shmRegion* region;
+  int me; // 0 for the creator, 1 for the other side
+  char* path; // <path>.<session>, split children append .<n>
+  unsigned splitCount;
+} shm2PTransport;
+
+// Spin briefly, then yield, then sleep: waits are usually short, but the
+//   other process may not even be scheduled
+static void shmBackoff(unsigned* spins)
+{ ++*spins;
+  if(*spins<64) return;
+  if(*spins<4096) { sched_yield(); return; }
+  struct timespec ts = {.tv_sec=0, .tv_nsec=20000};
+  nanosleep(&ts,NULL);
+}
+
+static bool shmTimedOut(const struct timespec* start)
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec-start->tv_sec>SHM_JOIN_TIMEOUT;
+}
+
+static int shm2PSend(ProtocolTransport* pt,int dest,const void* s,size_t n)
+{ shm2PTransport* t = CAST(pt);
+  shmRing* r = &t->region->ring[t->me];
+  uint64_t head = r->head;
+  size_t n2=0;
+  unsigned spins=0;
+  while(n2<n)
+  { size_t room = SHM_RING_SIZE-(head-__atomic_load_n(&r->tail,__ATOMIC_ACQUIRE));
+    if(room==0)
+    { if(__atomic_load_n(&t->region->closed[!t->me],__ATOMIC_ACQUIRE)) return -1;
+      shmBackoff(&spins);
+      continue;
+    }
+    size_t off = head%SHM_RING_SIZE, k = n-n2;
+    if(k>room) k=room;
+    if(k>SHM_RING_SIZE-off) k=SHM_RING_SIZE-off;
+    memcpy(r->data+off,(const char*)s+n2,k);
+    head+=k; n2+=k;
+    __atomic_store_n(&r->head,head,__ATOMIC_RELEASE);
+    spins=0;
+  }
+  return n2;
+}
+
+static int shm2PRecv(ProtocolTransport* pt,int src,void* s,size_t n)
+{ shm2PTransport* t = CAST(pt);
+  shmRing* r = &t->region->ring[!t->me];
+  uint64_t tail = r->tail;
+  size_t n2=0;
+  unsigned spins=0;
+  while(n2<n)
+  { size_t avail = __atomic_load_n(&r->head,__ATOMIC_ACQUIRE)-tail;
+    if(avail==0)
+    { // peer gone, and (checked after it left) nothing more is coming
+      if(__atomic_load_n(&t->region->closed[!t->me],__ATOMIC_ACQUIRE)
+         && __atomic_load_n(&r->head,__ATOMIC_ACQUIRE)==tail)
+      { fprintf(stderr,"Shared memory read error: peer has closed\n");
+        return -1;
+      }
+      shmBackoff(&spins);
+      continue;
+    }
+    size_t off = tail%SHM_RING_SIZE, k = n-n2;
+    if(k>avail) k=avail;
+    if(k>SHM_RING_SIZE-off) k=SHM_RING_SIZE-off;
+    memcpy((char*)s+n2,r->data+off,k);
+    tail+=k; n2+=k;
+    __atomic_store_n(&r->tail,tail,__ATOMIC_RELEASE);
+    spins=0;
+  }
+  return n2;
+}
+
+// Every send is published right away
+static int shm2PFlush(ProtocolTransport* pt) { return 0; }
+
+static void shm2PCleanup(ProtocolTransport* pt)
+{ shm2PTransport* t = CAST(pt);
+  __atomic_store_n(&t->region->closed[t->me],1,__ATOMIC_RELEASE);
+  munmap(t->region,sizeof(shmRegion));
+  free(t->path);
+  free(t);
+}
+
+static ProtocolTransport* shm2PSplit(ProtocolTransport* tsrc);
+
+// path is the full file name, session id included
+static shm2PTransport* shm2PNew(const char* path,bool isCreator)
+{ shmRegion* region;
+  struct timespec start;
+  unsigned spins=0;
+  int fd;
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  if(isCreator)
+  { unlink(path); // stale leftover from a crashed run of this session
+    fd = open(path,O_RDWR|O_CREAT|O_EXCL,0600);
+    if(fd<0) return NULL;
+    if(ftruncate(fd,sizeof(shmRegion))<0) { close(fd); unlink(path); return NULL; }
+    region = mmap(NULL,sizeof(shmRegion),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(region==MAP_FAILED) { unlink(path); return NULL; }
+    // ftruncate already zeroed everything else
+    __atomic_store_n(&region->magic,SHM_MAGIC,__ATOMIC_RELEASE);
+    while(!__atomic_load_n(&region->joined,__ATOMIC_ACQUIRE))
+    { if(shmTimedOut(&start))
+      { fprintf(stderr,"Shared memory: no peer joined %s\n",path);
+        munmap(region,sizeof(shmRegion));
+        unlink(path);
+        return NULL;
+      }
+      shmBackoff(&spins);
+    }
+    unlink(path); // both sides have it mapped now
+  }else
+  { struct stat st;
+    while(true)
+    { fd = open(path,O_RDWR);
+      if(fd>=0 && fstat(fd,&st)==0 && st.st_size>=sizeof(shmRegion)) break;
+      if(fd>=0) close(fd);
+      else if(errno!=ENOENT) return NULL;
+      if(shmTimedOut(&start))
+      { fprintf(stderr,"Shared memory: %s did not appear\n",path);
+        return NULL;
+      }
+      shmBackoff(&spins);
+    }
+    region = mmap(NULL,sizeof(shmRegion),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(region==MAP_FAILED) return NULL;
+    while(__atomic_load_n(&region->magic,__ATOMIC_ACQUIRE)!=SHM_MAGIC)
+    { if(shmTimedOut(&start))
+      { // the creator died halfway, nobody else will remove it
+        fprintf(stderr,"Shared memory: %s was never set up\n",path);
+        munmap(region,sizeof(shmRegion));
+        unlink(path);
+        return NULL;
+      }
+      shmBackoff(&spins);
+    }
+    __atomic_store_n(&region->joined,1,__ATOMIC_RELEASE);
+  }
+  shm2PTransport* t = malloc(sizeof(*t));
+  t->cb = (ProtocolTransport){.maxParties=2, .split=shm2PSplit, .send=shm2PSend,
+                              .recv=shm2PRecv, .flush=shm2PFlush,
+                              .cleanup=shm2PCleanup};
+  t->region = region;
+  t->me = (isCreator?0:1);
+  t->path = strdup(path);
+  t->splitCount = 0;
+  return t;
+}
+
+// Both parties split in the same order, so they agree on the new file name
+//   without talking to each other
+static ProtocolTransport* shm2PSplit(ProtocolTransport* tsrc)
+{ shm2PTransport* t = CAST(tsrc);
+  char* path = malloc(strlen(t->path)+16);
+  sprintf(path,"%s.%u",t->path,++t->splitCount);
+  shm2PTransport* tnew = shm2PNew(path,t->me==0);
+  if(tnew==NULL) fprintf(stderr,"shm2PSplit(): could not map %s\n",path);
+  free(path);
+  return CAST(tnew);
+}
+
+int protocolUseShm2P(ProtocolDesc* pd,const char* path,uint64_t session
+                    ,bool isCreator)
+{ char* name = malloc(strlen(path)+24);
+  sprintf(name,"%s.%016" PRIx64,path,session);
+  shm2PTransport* t = shm2PNew(name,isCreator);
+  free(name);
+  if(t==NULL) return -1;
+  pd->trans = &t->cb;
+  return 0;
+}
+
+typedef struct
+{ ProtocolTransport cb;
+  ProtocolDesc pd;
+} SizeCheckTransportAdapter; // spliced object
+
+static int sizeCheckSend(ProtocolTransport* pt,int dest,const void* s,size_t n)
+{ int sent = osend(&((SizeCheckTransportAdapter*)pt)->pd,dest,s,n);
+  if(sent==n) return n;
+  else
+  { fprintf(stderr,"Was going to send %zu bytes to %d, sent %d\n",
+                   n,dest,sent);
+    if(sent<0) fprintf(stderr,"That means %s\n",strerror(sent));
+    exit(-1);
+  }
+}
+
+static int sizeCheckRecv(ProtocolTransport* pt,int src,void* s,size_t n)
+{ int recv = orecv(&((SizeCheckTransportAdapter*)pt)->pd,src,s,n);
+  if(recv==n) return n;
+  else
+  { fprintf(stderr,"Was going to recv %zu bytes from %d, received %d\n",
+                    n,src,recv);
+    if(recv<0) fprintf(stderr,"That means %s\n",strerror(recv));
+    exit(-1);
+  }
+}
+static void sizeCheckCleanup(ProtocolTransport* pt)
+{ ProtocolTransport *inner = ((SizeCheckTransportAdapter*)pt)->pd.trans;
+  inner->cleanup(inner);
+  free(pt);
+}
+
+void protocolAddSizeCheck(ProtocolDesc* pd)
+{
+  SizeCheckTransportAdapter* t = malloc(sizeof(SizeCheckTransportAdapter));
+  t->pd = *pd; // Dummy protocol object, sliced just for the Transport object
+  pd->trans = &t->cb;
+  t->cb.send=sizeCheckSend;
+  t->cb.recv=sizeCheckRecv;
+  t->cb.cleanup=sizeCheckCleanup;
+}
+
+// --------------------------- Striped trans ---------------------------------
+
+// Spreads one ordered byte stream over several connections, for links where
+//   a single TCP stream cannot fill the pipe. Data is cut into chunks, chunk
+//   number i goes to lane i%k, and each lane has a sender thread so that one
+//   slow lane does not hold up the others. The receiver reads the chunks
+//   back in sequence order. Lanes are any splittable transports, created
+//   with split() on the original one (i.e. sockSplit for TCP and TLS).
+#define STRIPE_CHUNK (1<<16)
+#define STRIPE_MAX_QUEUED 8 // per lane, bounds memory use
+#define STRIPE_HEADER 12    // 8-byte sequence number, 4-byte length
+
+typedef struct stripeChunk
+{ struct stripeChunk* next;
+  size_t len; // payload only
+  unsigned char data[STRIPE_HEADER+STRIPE_CHUNK];
+} stripeChunk;
+
+typedef struct
+{ ProtocolTransport* t;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  stripeChunk *head, *tail;
+  int queued;
+  bool busy, stop;
+  int error;
+} stripeLane;
+
+typedef struct
+{ ProtocolTransport cb;
+  int k;
+  stripeLane* lanes;
+  stripeChunk* wchunk; // being filled
+  uint64_t wseq, rseq;
+  unsigned char* rbuf;
+  size_t rstart, rend;
+  bool needFlush;
+} stripedTransport;
+
+// Lane threads own their transport while busy or queued is nonzero. The
+//   protocol thread only touches it (recv, split, cleanup) after a flush.
+static void* stripeLaneThread(void* va)
+{ stripeLane* l = va;
+  pthread_mutex_lock(&l->lock);
+  while(true)
+  { while(l->head==NULL && !l->stop) pthread_cond_wait(&l->cond,&l->lock);
+    if(l->head==NULL) break;
+    stripeChunk* c = l->head;
+    l->head = c->next;
+    if(l->head==NULL) l->tail=NULL;
+    l->busy = true;
+    pthread_mutex_unlock(&l->lock);
+    int res = transSend(l->t,0,c->data,STRIPE_HEADER+c->len);
+    free(c);
+    pthread_mutex_lock(&l->lock);
+    l->queued--;
+    if(l->head==NULL)
+    { pthread_mutex_unlock(&l->lock);
+      if(transFlush(l->t)<0) res=-1;
+      pthread_mutex_lock(&l->lock);
+    }
+    if(res<0) l->error=-1;
+    l->busy = false;
+    pthread_cond_broadcast(&l->cond);
+  }
+  pthread_mutex_unlock(&l->lock);
+  return NULL;
+}
+
+static void stripePush(stripedTransport* st)
+{ stripeChunk* c = st->wchunk;
+  stripeLane* l = &st->lanes[st->wseq%st->k];
+  memcpy(c->data,&st->wseq,8);
+  uint32_t len = c->len;
+  memcpy(c->data+8,&len,4);
+  c->next = NULL;
+  st->wseq++;
+  pthread_mutex_lock(&l->lock);
+  while(l->queued>=STRIPE_MAX_QUEUED) pthread_cond_wait(&l->cond,&l->lock);
+  if(l->tail) l->tail->next=c; else l->head=c;
+  l->tail=c;
+  l->queued++;
+  pthread_cond_broadcast(&l->cond);
+  pthread_mutex_unlock(&l->lock);
+  st->wchunk = malloc(sizeof(stripeChunk));
+  st->wchunk->len = 0;
+}
+
+static int stripedSend(ProtocolTransport* pt,int dest,const void* s,size_t n)
+{ stripedTransport* st = CAST(pt);
+  size_t n2=0;
+  st->needFlush=true;
+  while(n2<n)
+  { stripeChunk* c = st->wchunk;
+    size_t k = STRIPE_CHUNK-c->len;
+    if(k>n-n2) k=n-n2;
+    memcpy(c->data+STRIPE_HEADER+c->len,(const char*)s+n2,k);
+    c->len+=k; n2+=k;
+    if(c->len==STRIPE_CHUNK) stripePush(st);
+  }
+  return n2;
+}
+
+// Returns only once every lane has written and flushed everything
+static int stripedFlush(ProtocolTransport* pt)
+{ stripedTransport* st = CAST(pt);
+  int i, res=0;
+  if(st->wchunk->len) stripePush(st);
+  for(i=0;i<st->k;i++)
+  { stripeLane* l = &st->lanes[i];
+    pthread_mutex_lock(&l->lock);
+    while(l->queued || l->busy) pthread_cond_wait(&l->cond,&l->lock);
+    if(l->error) res=-1;
+    pthread_mutex_unlock(&l->lock);
+  }
+  return res;
+}
+
+static int stripedRecv(ProtocolTransport* pt,int src,void* s,size_t n)
+{ stripedTransport* st = CAST(pt);
+  size_t n2=0;
+  if(st->needFlush)
+  { transFlush(pt);
+    st->needFlush=false;
+  }
+  while(n2<n)
+  { size_t avail = st->rend-st->rstart;
+    if(avail==0)
+    { ProtocolTransport* lane = st->lanes[st->rseq%st->k].t;
+      unsigned char hdr[STRIPE_HEADER];
+      uint64_t seq;
+      uint32_t len;
+      if(transRecv(lane,0,hdr,STRIPE_HEADER)<0) return -1;
+      memcpy(&seq,hdr,8);
+      memcpy(&len,hdr+8,4);
+      if(seq!=st->rseq || len>STRIPE_CHUNK)
+      { fprintf(stderr,"Striped transport: expected chunk %" PRIu64
+                       ", got %" PRIu64 "\n",st->rseq,seq);
+        return -1;
+      }
+      st->rseq++;
+      if(len<=n-n2) // whole chunk wanted, skip the copy
+      { if(transRecv(lane,0,(char*)s+n2,len)<0) return -1;
+        n2+=len;
+        continue;
+      }
+      if(transRecv(lane,0,st->rbuf,len)<0) return -1;
+      st->rstart=0;
+      st->rend=avail=len;
+    }
+    if(avail>n-n2) avail=n-n2;
+    memcpy((char*)s+n2,st->rbuf+st->rstart,avail);
+    st->rstart+=avail;
+    n2+=avail;
+  }
+  return n2;
+}
+
+static void stripedCleanup(ProtocolTransport* pt)
+{ stripedTransport* st = CAST(pt);
+  int i;
+  transFlush(pt);
+  for(i=0;i<st->k;i++)
+  { stripeLane* l = &st->lanes[i];
+    pthread_mutex_lock(&l->lock);
+    l->stop=true;
+    pthread_cond_broadcast(&l->cond);
+    pthread_mutex_unlock(&l->lock);
+    pthread_join(l->thread,NULL);
+    pthread_mutex_destroy(&l->lock);
+    pthread_cond_destroy(&l->cond);
+  }
+  // splits go before the connection they were split from
+  for(i=st->k-1;i>=0;i--) st->lanes[i].t->cleanup(st->lanes[i].t);
+  free(st->lanes);
+  free(st->wchunk);
+  free(st->rbuf);
+  free(st);
+}
+
+static ProtocolTransport* stripedSplit(ProtocolTransport* tsrc);
+
+static stripedTransport* stripedNew(ProtocolTransport** lanes,int k)
+{ stripedTransport* st = malloc(sizeof(*st));
+  int i;
+  st->cb = (ProtocolTransport){.maxParties=2, .split=stripedSplit,
+    .send=stripedSend, .recv=stripedRecv, .flush=stripedFlush,
+    .cleanup=stripedCleanup};
+  st->k = k;
+  st->lanes = calloc(k,sizeof(stripeLane));
+  st->wchunk = malloc(sizeof(stripeChunk));
+  st->wchunk->len = 0;
+  st->wseq = st->rseq = 0;
+  st->rbuf = malloc(STRIPE_CHUNK);
+  st->rstart = st->rend = 0;
+  st->needFlush = false;
+  for(i=0;i<k;i++)
+  { stripeLane* l = &st->lanes[i];
+    l->t = lanes[i];
+    pthread_mutex_init(&l->lock,NULL);
+    pthread_cond_init(&l->cond,NULL);
+    pthread_create(&l->thread,NULL,stripeLaneThread,l);
+  }
+  return st;
+}
+
+// Splits every lane, so the new transport is striped just as wide
+static ProtocolTransport* stripedSplit(ProtocolTransport* tsrc)
+{ stripedTransport* st = CAST(tsrc);
+  ProtocolTransport* lanes[st->k];
+  int i;
+  if(transFlush(tsrc)<0) return NULL;
+  for(i=0;i<st->k;i++)
+  { lanes[i] = st->lanes[i].t->split(st->lanes[i].t);
+    if(lanes[i]==NULL)
+    { while(i--) lanes[i]->cleanup(lanes[i]);
+      return NULL;
+    }
+  }
+  return CAST(stripedNew(lanes,st->k));
+}
+
+int protocolAddStriping(ProtocolDesc* pd,int lanes)
+{
+  ProtocolTransport* t[lanes>0?lanes:1];
+  int i;
+  if(lanes<=1) return 0;
+  if(pd->trans->split==NULL) return -1;
+  t[0] = pd->trans;
+  for(i=1;i<lanes;i++)
+  { t[i] = t[0]->split(t[0]);
+    if(t[i]==NULL)
+    { while(--i>0) t[i]->cleanup(t[i]);
+      return -1;
+    }
+  }
+  pd->trans = &stripedNew(t,lanes)->cb;
+  return 0;
+}
+
+// -------------------------- Pipelined trans --------------------------------
+
+// Moves transport work off the protocol thread, so that e.g. the generator
+//   can keep garbling while its tables are encrypted and written out. Bytes
+//   sent go into a lock-free single-producer single-consumer ring, which a
+//   sender thread drains into the wrapped transport. If that transport is
+//   tcp2P, a reader thread also prefetches from the socket into a second
+//   ring. Other transports are read on the protocol thread, since e.g. an
+//   SSL object cannot be read and written from two threads at once.
+// Head and tail only grow. Each is written by one side, read by both. A
+//   side that has to wait announces how much it needs in wantData/wantFree
+//   and sleeps on cond; the other side only takes the lock to wake it once
+//   that much is there, so a fast-flowing ring never touches the mutex.
+#define PIPE_RING_SIZE  (1<<22)
+#define PIPE_SEND_BATCH (1<<16) // the sender thread waits for this much
+#define PIPE_READ_MIN   (1<<16) // the reader thread waits for this much room
+
+typedef struct
+{ char* buf;
+  size_t size; // a power of 2
+  size_t head, tail;
+  size_t wantData, wantFree; // 0 unless someone is waiting
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool flushing, stop;
+  int error;
+} pipeRing;
+
+typedef struct
+{ ProtocolTransport cb;
+  ProtocolTransport* inner;
+  pipeRing out, in;
+  pthread_t sender, reader;
+  bool hasReader, needFlush;
+  int wakefd[2]; // written to stop the reader's poll()
+} pipeTransport;
+
+static void pipeRingInit(pipeRing* r,size_t size)
+{ r->buf = malloc(size);
+  r->size = size;
+  r->head = r->tail = 0;
+  r->wantData = r->wantFree = 0;
+  pthread_mutex_init(&r->lock,NULL);
+  pthread_cond_init(&r->cond,NULL);
+  r->flushing = r->stop = false;
+  r->error = 0;
+}
+
+static void pipeRingRelease(pipeRing* r)
+{ pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  free(r->buf);
+}
+
+static inline size_t pipeUsed(pipeRing* r)
+{ return __atomic_load_n(&r->tail,__ATOMIC_SEQ_CST)
+       - __atomic_load_n(&r->head,__ATOMIC_SEQ_CST);
+}
+
+static void pipeWake(pipeRing* r)
+{ pthread_mutex_lock(&r->lock);
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// Blocks until at least n bytes are in the ring (data) or free (!data), or
+//   stop is set. Waiting for data also ends if there is any and flushing is
+//   set. n is capped at the ring size.
+static void pipeWait(pipeRing* r,bool data,size_t n)
+{ size_t* want = (data?&r->wantData:&r->wantFree);
+  if(n>r->size) n=r->size;
+  pthread_mutex_lock(&r->lock);
+  while(true)
+  { __atomic_store_n(want,n,__ATOMIC_SEQ_CST); // cleared by whoever wakes us
+    if(r->stop || r->error
+       || (data?pipeUsed(r)>=n || (r->flushing && pipeUsed(r))
+               :r->size-pipeUsed(r)>=n)) break;
+    pthread_cond_wait(&r->cond,&r->lock);
+  }
+  __atomic_store_n(want,0,__ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// Wakes the other side if it waits for no more than have. Only the first
+//   caller to see that takes the lock, the waiter may take a while to run.
+static inline void pipeWakeFor(pipeRing* r,size_t* want,size_t have)
+{ size_t w = __atomic_load_n(want,__ATOMIC_SEQ_CST);
+  if(w && have>=w && __atomic_exchange_n(want,0,__ATOMIC_SEQ_CST))
+    pipeWake(r);
+}
+
+// Producer side: publish n more bytes already written at the old tail
+static void pipePublish(pipeRing* r,size_t n)
+{ __atomic_store_n(&r->tail,r->tail+n,__ATOMIC_SEQ_CST);
+  pipeWakeFor(r,&r->wantData,pipeUsed(r));
+}
+
+// Consumer side: release n bytes at head
+static void pipeConsume(pipeRing* r,size_t n)
+{ __atomic_store_n(&r->head,r->head+n,__ATOMIC_SEQ_CST);
+  pipeWakeFor(r,&r->wantFree,r->size-pipeUsed(r));
+}
+
+static void pipeStop(pipeRing* r)
+{ pthread_mutex_lock(&r->lock);
+  r->stop = true;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// Sender thread: drains out into the wrapped transport, in batches unless
+//   the protocol thread is waiting for a flush or for room
+static void* pipeSenderThread(void* va)
+{ pipeTransport* pt = va;
+  pipeRing* r = &pt->out;
+  while(true)
+  { size_t n = pipeUsed(r);
+    bool stop = __atomic_load_n(&r->stop,__ATOMIC_SEQ_CST);
+    if(n==0 && stop) break;
+    if(n<PIPE_SEND_BATCH && !stop
+       && !(n && (__atomic_load_n(&r->flushing,__ATOMIC_SEQ_CST)
+                  || __atomic_load_n(&r->wantFree,__ATOMIC_SEQ_CST))))
+    { pipeWait(r,true,n?PIPE_SEND_BATCH:1);
+      continue;
+    }
+    size_t at = r->head&(r->size-1);
+    if(n>r->size-at) n=r->size-at;
+    if(transSend(pt->inner,0,r->buf+at,n)<0)
+    { pthread_mutex_lock(&r->lock);
+      r->error = -1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      break;
+    }
+    pipeConsume(r,n);
   }
+  return NULL;
+}
 
-  tls2PTransport* tnew = tls2PNew(newsock, tlst->ssl_ctx, ssl, tlst->isClient, tlst->isProfiled, tlst->ssl_buffer_size);
-  tnew->parent = tlst;
-  return CAST(tnew);
+// Reader thread: fills in straight from the tcp2P socket
+static void* pipeReaderThread(void* va)
+{ pipeTransport* pt = va;
+  pipeRing* r = &pt->in;
+  int sock = ((tcp2PTransport*)CAST(pt->inner))->sock;
+  while(!__atomic_load_n(&r->stop,__ATOMIC_SEQ_CST))
+  { size_t room = r->size-pipeUsed(r);
+    if(room<PIPE_READ_MIN) { pipeWait(r,false,PIPE_READ_MIN); continue; }
+    struct pollfd p[2] = {{.fd=sock, .events=POLLIN},
+                          {.fd=pt->wakefd[0], .events=POLLIN}};
+    if(poll(p,2,-1)<0) { if(errno==EINTR) continue; break; }
+    if(p[1].revents) break;
+    size_t at = r->tail&(r->size-1);
+    if(room>r->size-at) room=r->size-at;
+    ssize_t res = read(sock,r->buf+at,room);
+    if(res<0 && (errno==EINTR || errno==EAGAIN)) continue;
+    if(res<=0) // the peer may well be done: only an error if we need more
+    { if(res<0) perror("TCP read error: ");
+      pthread_mutex_lock(&r->lock);
+      r->error = -1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      break;
+    }
+    pipePublish(r,res);
+  }
+  return NULL;
 }
 
-typedef struct
-{ ProtocolTransport cb;
-  ProtocolDesc pd;
-} SizeCheckTransportAdapter; // spliced object
+static int pipeSend(ProtocolTransport* t,int dest,const void* s,size_t n)
+{ pipeTransport* pt = CAST(t);
+  pipeRing* r = &pt->out;
+  size_t n2=0;
+  pt->needFlush = true;
+  while(n2<n)
+  { size_t room = r->size-pipeUsed(r);
+    if(room==0)
+    { // not all of n-n2: the sender thread may be holding back less than
+      //   a batch, left over from the ring's wrap point
+      pipeWait(r,false,(n-n2<PIPE_SEND_BATCH?n-n2:PIPE_SEND_BATCH));
+      if(__atomic_load_n(&r->error,__ATOMIC_SEQ_CST)) return -1;
+      continue;
+    }
+    size_t at = r->tail&(r->size-1);
+    if(room>n-n2) room=n-n2;
+    if(room>r->size-at) room=r->size-at;
+    memcpy(r->buf+at,(const char*)s+n2,room);
+    pipePublish(r,room);
+    n2+=room;
+  }
+  return n2;
+}
 
-static int sizeCheckSend(ProtocolTransport* pt,int dest,const void* s,size_t n)
-{ int sent = osend(&((SizeCheckTransportAdapter*)pt)->pd,dest,s,n);
-  if(sent==n) return n;
-  else
-  { fprintf(stderr,"Was going to send %zu bytes to %d, sent %d\n",
-                   n,dest,sent);
-    if(sent<0) fprintf(stderr,"That means %s\n",strerror(sent));
-    exit(-1);
+// Returns once the sender thread has handed everything to the wrapped
+//   transport, and that has been flushed. The sender thread is then idle,
+//   so the wrapped transport is ours until the next pipeSend().
+static int pipeFlush(ProtocolTransport* t)
+{ pipeTransport* pt = CAST(t);
+  pipeRing* r = &pt->out;
+  if(pipeUsed(r))
+  { __atomic_store_n(&r->flushing,true,__ATOMIC_SEQ_CST);
+    pipeWake(r);
+    while(pipeUsed(r) && !__atomic_load_n(&r->error,__ATOMIC_SEQ_CST))
+      pipeWait(r,false,r->size);
+    __atomic_store_n(&r->flushing,false,__ATOMIC_SEQ_CST);
   }
+  if(r->error) return -1;
+  pt->needFlush = false;
+  return transFlush(pt->inner);
 }
 
-static int sizeCheckRecv(ProtocolTransport* pt,int src,void* s,size_t n)
-{ int recv = orecv(&((SizeCheckTransportAdapter*)pt)->pd,src,s,n);
-  if(recv==n) return n;
-  else
-  { fprintf(stderr,"Was going to recv %zu bytes from %d, received %d\n",
-                    n,src,recv);
-    if(recv<0) fprintf(stderr,"That means %s\n",strerror(recv));
-    exit(-1);
+static int pipeRecv(ProtocolTransport* t,int src,void* s,size_t n)
+{ pipeTransport* pt = CAST(t);
+  pipeRing* r = &pt->in;
+  size_t n2=0;
+  if(!pt->hasReader)
+  { if(pt->needFlush && pipeFlush(t)<0) return -1;
+    return transRecv(pt->inner,src,s,n);
+  }
+  while(n2<n)
+  { size_t avail = pipeUsed(r);
+    if(avail==0)
+    { // the peer may be waiting on what we have sent so far
+      if(pt->needFlush && pipeFlush(t)<0) return -1;
+      // likewise, the reader thread stops short of a full ring
+      pipeWait(r,true,(n-n2<PIPE_READ_MIN?n-n2:PIPE_READ_MIN));
+      if(pipeUsed(r)==0 && __atomic_load_n(&r->error,__ATOMIC_SEQ_CST))
+      { fprintf(stderr,"TCP read error: connection closed\n");
+        return -1;
+      }
+      continue;
+    }
+    size_t at = r->head&(r->size-1);
+    if(avail>n-n2) avail=n-n2;
+    if(avail>r->size-at) avail=r->size-at;
+    memcpy((char*)s+n2,r->buf+at,avail);
+    pipeConsume(r,avail);
+    n2+=avail;
   }
+  return n2;
 }
-static void sizeCheckCleanup(ProtocolTransport* pt)
-{ ProtocolTransport *inner = ((SizeCheckTransportAdapter*)pt)->pd.trans;
-  inner->cleanup(inner);
+
+// Plain split of the wrapped transport. With a reader thread, the new
+//   port number has to come through our ring.
+static ProtocolTransport* pipeSplit(ProtocolTransport* t)
+{ pipeTransport* pt = CAST(t);
+  if(pipeFlush(t)<0) return NULL;
+  if(pt->hasReader) return CAST(tcp2PSplitVia(pt->inner,t));
+  return pt->inner->split(pt->inner);
+}
+
+static void pipeCleanup(ProtocolTransport* t);
+
+// Wraps pd->trans until protocolRemovePipelining(pd)
+static void protocolAddPipelining(ProtocolDesc* pd)
+{ pipeTransport* pt = malloc(sizeof(*pt));
+  ProtocolTransport* inner = pd->trans;
+  pt->cb = (ProtocolTransport){.maxParties=inner->maxParties,
+    .split=(inner->split?pipeSplit:NULL), .send=pipeSend, .recv=pipeRecv,
+    .flush=pipeFlush, .cleanup=pipeCleanup};
+  transFlush(inner); // the sender thread must not inherit half a buffer
+  pt->inner = inner;
+  pt->needFlush = false;
+  pt->hasReader = transIsTcp2P(inner) && pipe(pt->wakefd)==0;
+  pipeRingInit(&pt->out,PIPE_RING_SIZE);
+  pthread_create(&pt->sender,NULL,pipeSenderThread,pt);
+  if(pt->hasReader)
+  { tcp2PTransport* tcpt = CAST(inner);
+    size_t size = PIPE_RING_SIZE, avail = tcpt->rend-tcpt->rstart;
+    while(size<2*avail) size*=2;
+    pipeRingInit(&pt->in,size);
+    // whatever tcp2P had read ahead comes first
+    memcpy(pt->in.buf,tcpt->rbuf+tcpt->rstart,avail);
+    pt->in.tail = avail;
+    tcpt->rstart = tcpt->rend = 0;
+    pthread_create(&pt->reader,NULL,pipeReaderThread,pt);
+  }
+  pd->trans = &pt->cb;
+}
+
+// Stops both threads. Anything the reader thread fetched but the protocol
+//   did not consume goes back to tcp2P's read-ahead buffer.
+static void protocolRemovePipelining(ProtocolDesc* pd)
+{ pipeTransport* pt = CAST(pd->trans);
+  pipeFlush(&pt->cb);
+  pipeStop(&pt->out);
+  pthread_join(pt->sender,NULL);
+  pipeRingRelease(&pt->out);
+  if(pt->hasReader)
+  { tcp2PTransport* tcpt = CAST(pt->inner);
+    pipeRing* r = &pt->in;
+    char c = 0;
+    pipeStop(r);
+    if(write(pt->wakefd[1],&c,1)<0) perror("pipeline stop: ");
+    pthread_join(pt->reader,NULL);
+    close(pt->wakefd[0]);
+    close(pt->wakefd[1]);
+    size_t avail = r->tail-r->head, at = r->head&(r->size-1);
+    char* rbuf = malloc(avail>tcpt->bufSize?avail:tcpt->bufSize);
+    size_t k = (avail>r->size-at?r->size-at:avail);
+    memcpy(rbuf,r->buf+at,k);
+    memcpy(rbuf+k,r->buf,avail-k);
+    free(tcpt->rbuf);
+    tcpt->rbuf=rbuf; tcpt->rstart=0; tcpt->rend=avail;
+    pipeRingRelease(r);
+  }
+  pd->trans = pt->inner;
   free(pt);
 }
 
-void protocolAddSizeCheck(ProtocolDesc* pd)
-{
-  SizeCheckTransportAdapter* t = malloc(sizeof(SizeCheckTransportAdapter));
-  t->pd = *pd; // Dummy protocol object, sliced just for the Transport object
-  pd->trans = &t->cb;
-  t->cb.send=sizeCheckSend;
-  t->cb.recv=sizeCheckRecv;
-  t->cb.cleanup=sizeCheckCleanup;
+static void pipeCleanup(ProtocolTransport* t)
+{ ProtocolDesc pd = {.trans=t};
+  protocolRemovePipelining(&pd);
+  pd.trans->cleanup(pd.trans);
 }
 
 // --------------------------- Protocols -----------------------------------
@@ -1079,11 +2587,15 @@ bool ocSplitProto(ProtocolDesc* pdout, ProtocolDesc * pdin)
       .currentParty = pdin->currentParty,
       .feedOblivInputs = pdin->feedOblivInputs,
       .revealOblivBits = pdin->revealOblivBits,
+      .revealOblivBitsN = pdin->revealOblivBitsN,
       .setBitAnd = pdin->setBitAnd,
       .setBitOr = pdin->setBitOr,
       .setBitXor = pdin->setBitXor,
       .setBitNot = pdin->setBitNot,
       .flipBit = pdin->flipBit,
+      .setBitsAndN = pdin->setBitsAndN,
+      .setBitsOrN = pdin->setBitsOrN,
+      .muxN = pdin->muxN,
       .thisParty = pdin->thisParty,
       .trans = pdin->trans->split(pdin->trans),
       .splitextra = pdin->splitextra,
@@ -1097,8 +2609,9 @@ bool ocSplitProto(ProtocolDesc* pdout, ProtocolDesc * pdin)
 
 void ocCleanupProto(ProtocolDesc* pd)
   {
-    pd->trans->cleanup(pd->trans);
+    // extra first: it may own transports split off from pd->trans
     if (pd->extra != NULL) pd->cleanextra(pd);
+    pd->trans->cleanup(pd->trans);
   }
 
 void cleanupProtocol(ProtocolDesc* pd)
@@ -1188,11 +2701,15 @@ void execDebugProtocol(ProtocolDesc* pd, protocol_run start, void* arg)
   pd->error = 0;
   pd->feedOblivInputs = dbgProtoFeedOblivInputs;
   pd->revealOblivBits = dbgProtoRevealOblivBits;
+  pd->revealOblivBitsN = NULL;
   pd->setBitAnd = dbgProtoSetBitAnd;
   pd->setBitOr  = dbgProtoSetBitOr;
   pd->setBitXor = dbgProtoSetBitXor;
   pd->setBitNot = dbgProtoSetBitNot;
   pd->flipBit   = dbgProtoFlipBit;
+  pd->setBitsAndN = NULL;
+  pd->setBitsOrN  = NULL;
+  pd->muxN        = NULL;
   pd->partyCount= 2;
   pd->extra = NULL;
   currentProto = pd;
@@ -1339,16 +2856,18 @@ void yaoSetHashMask(YaoProtocolDesc* ypd,
   yaoKeyXor(d,buf);
 }
 
-// Why am I using SHA1 as a PRG? Not necessarily safe. TODO change to AES
+// Fresh 0-labels for the next n inputs: AES_I(icount), AES_I(icount+1), ...
+//   The 1-labels are these xor R.
+void yaoKeyNewLabels(YaoProtocolDesc* pd,block* w0,size_t n)
+{
+  AESCTR_gen(&pd->label_prg,pd->icount,w0,n);
+  pd->icount+=n;
+}
 void yaoKeyNewPair(YaoProtocolDesc* pd,yao_key_t w0,yao_key_t w1)
 {
-  uint64_t* ic = &pd->icount;
-  char buf[YAO_KEY_BYTES+sizeof(*ic)], dest[20];
-  memcpy(buf,pd->I,YAO_KEY_BYTES);
-  memcpy(buf+YAO_KEY_BYTES,ic,sizeof(*ic));
-  (*ic)++;
-  gcry_md_hash_buffer(GCRY_MD_SHA1,dest,buf,sizeof(buf));
-  memcpy(w0,dest,YAO_KEY_BYTES);
+  block w;
+  yaoKeyNewLabels(pd,&w,1);
+  memcpy(w0,&w,YAO_KEY_BYTES);
   yaoKeyCopy(w1,w0);
   yaoKeyXor(w1,pd->R);
 }
@@ -1376,41 +2895,54 @@ void yaoSetBitNot(ProtocolDesc* pd,OblivBit* r,const OblivBit* a)
 
 #define YAO_FEED_MAX_BATCH 1000000
 
+// Labels come from yaoKeyNewLabels a batch at a time, which is what makes
+//   AES-CTR faster than one hash call per bit. This is the batch size where
+//   nothing else bounds it.
+#define YAO_LABEL_BATCH 1024
+
 void yaoGenrFeedOblivInputs(ProtocolDesc* pd
                            ,OblivInputs* oi,size_t n,int src)
 {
   YaoProtocolDesc* ypd = pd->extra;
-  yao_key_t w0,w1;
   OIBitSrc it = oiBitSrc(oi,n);
-  if(src==1) for(;hasBit(&it);nextBit(&it))
-  { OblivBit* o = curDestBit(&it);
-    yaoKeyNewPair(ypd,w0,w1); // does ypd->icount++
-    if(curBit(&it)) osend(pd,2,w1,YAO_KEY_BYTES);
-    else osend(pd,2,w0,YAO_KEY_BYTES);
-    o->yao.inverted = false; o->unknown = true;
-    yaoKeyCopy(o->yao.w,w0);
+  size_t bc = bitCount(&it), m, i;
+  block R;
+  memcpy(&R,ypd->R,YAO_KEY_BYTES);
+  if(src==1)
+  { // limit memory usage
+    size_t batch = (bc<YAO_FEED_MAX_BATCH?bc:YAO_FEED_MAX_BATCH);
+    block *buf = malloc(batch*sizeof(block));
+    while(hasBit(&it)) // one send per batch
+    { m = (bc<batch?bc:batch);
+      yaoKeyNewLabels(ypd,buf,m); // does ypd->icount+=m
+      for(i=0;i<m;++i,nextBit(&it))
+      { OblivBit* o = curDestBit(&it);
+        o->yao.inverted = false; o->unknown = true;
+        yaoBitStore(o,buf[i]);
+        if(curBit(&it)) buf[i]^=R;
+      }
+      osend(pd,2,buf,m*YAO_KEY_BYTES);
+      bc-=m;
+    }
+    free(buf);
   }else
-  { size_t bc = bitCount(&it);
-    // limit memory usage
+  { // limit memory usage
     size_t batch = (bc<YAO_FEED_MAX_BATCH?bc:YAO_FEED_MAX_BATCH);
-    char *buf0 = malloc(batch*YAO_KEY_BYTES),
-         *buf1 = malloc(batch*YAO_KEY_BYTES);
-    size_t bp=0;
-    for(;hasBit(&it);nextBit(&it))
-    {
-      OblivBit* o = curDestBit(&it);
-      yaoKeyNewPair(ypd,w0,w1); // does ypd->icount++
-      yaoKeyCopy(buf0+bp*YAO_KEY_BYTES,w0);
-      yaoKeyCopy(buf1+bp*YAO_KEY_BYTES,w1);
-      o->yao.inverted = false; o->unknown = true;
-      yaoKeyCopy(o->yao.w,w0);
-      ++bp;
-      if(bp>=batch) // flush out every now and then
-      { ypd->sender.send(ypd->sender.sender,buf0,buf1,bp,YAO_KEY_BYTES);
-        bp=0;
+    block *buf0 = malloc(batch*sizeof(block)),
+          *buf1 = malloc(batch*sizeof(block));
+    while(hasBit(&it)) // flush out every now and then
+    { m = (bc<batch?bc:batch);
+      yaoKeyNewLabels(ypd,buf0,m); // does ypd->icount+=m
+      for(i=0;i<m;++i,nextBit(&it))
+      { OblivBit* o = curDestBit(&it);
+        buf1[i] = buf0[i]^R;
+        o->yao.inverted = false; o->unknown = true;
+        yaoBitStore(o,buf0[i]);
       }
+      ypd->sender.send(ypd->sender.sender,(char*)buf0,(char*)buf1,m,
+                       YAO_KEY_BYTES);
+      bc-=m;
     }
-    if(bp) ypd->sender.send(ypd->sender.sender,buf0,buf1,bp,YAO_KEY_BYTES);
     free(buf0); free(buf1);
   }
 }
@@ -1418,11 +2950,23 @@ void yaoEvalFeedOblivInputs(ProtocolDesc* pd
                            ,OblivInputs* oi,size_t n,int src)
 { OIBitSrc it = oiBitSrc(oi,n);
   YaoProtocolDesc* ypd = pd->extra;
-  if(src==1) for(;hasBit(&it);nextBit(&it))
-  { OblivBit* o = curDestBit(&it);
-    orecv(pd,1,o->yao.w,YAO_KEY_BYTES);
-    o->unknown = true;
-    ypd->icount++;
+  if(src==1)
+  { size_t bc = bitCount(&it), m, i;
+    // limit memory usage
+    size_t batch = (bc<YAO_FEED_MAX_BATCH?bc:YAO_FEED_MAX_BATCH);
+    block *buf = malloc(batch*sizeof(block));
+    while(hasBit(&it))
+    { m = (bc<batch?bc:batch);
+      orecv(pd,1,buf,m*YAO_KEY_BYTES);
+      for(i=0;i<m;++i,nextBit(&it))
+      { OblivBit* o = curDestBit(&it);
+        yaoBitStore(o,buf[i]);
+        o->unknown = true;
+      }
+      ypd->icount+=m;
+      bc-=m;
+    }
+    free(buf);
   }else
   { size_t bc = bitCount(&it);
     // limit memory usage
@@ -1487,6 +3031,54 @@ bool yaoEvalRevealOblivBits(ProtocolDesc* pd,
   else return false;
 }
 
+// Bulk versions of the above: one message per direction for any n.
+//   dest is char[(n+7)/8] of packed bits, same layout as the widest_t case
+// flipflags has the permute bit of every unknown output's 0-label
+static bool yaoGenrRevealFlipflags(ProtocolDesc* pd,char* dest,
+    const OblivBit* o,size_t n,int party,const char* flipflags)
+{
+  size_t i,bc=(n+7)/8;
+  YaoProtocolDesc *ypd = pd->extra;
+  if(party != 1) osend(pd,2,flipflags,bc);
+  if(party != 2)
+  { orecv(pd,2,dest,bc);
+    memxor(dest,flipflags,bc);
+    for(i=0;i<n;++i) if(!o[i].unknown) setBit(dest,i,o[i].knownValue);
+  }
+  ypd->ocount+=n;
+  return party!=2;
+}
+bool yaoGenrRevealOblivBitsN(ProtocolDesc* pd,
+    char* dest,const OblivBit* o,size_t n,int party)
+{
+  size_t i,bc=(n+7)/8;
+  char *flipflags = calloc(bc,1);
+  bool rv;
+  for(i=0;i<n;++i) if(o[i].unknown)
+    xorBit(flipflags,i,yaoKeyLsb(o[i].yao.w) != o[i].yao.inverted);
+  rv = yaoGenrRevealFlipflags(pd,dest,o,n,party,flipflags);
+  free(flipflags);
+  return rv;
+}
+bool yaoEvalRevealOblivBitsN(ProtocolDesc* pd,
+    char* dest,const OblivBit* o,size_t n,int party)
+{
+  size_t i,bc=(n+7)/8;
+  YaoProtocolDesc *ypd = pd->extra;
+  char *flipflags = calloc(bc,1);
+  for(i=0;i<n;++i) if(o[i].unknown)
+    xorBit(flipflags,i,yaoKeyLsb(o[i].yao.w));
+  if(party != 1)
+  { orecv(pd,1,dest,bc);
+    memxor(dest,flipflags,bc);
+    for(i=0;i<n;++i) if(!o[i].unknown) setBit(dest,i,o[i].knownValue);
+  }
+  if(party != 2) osend(pd,1,flipflags,bc);
+  free(flipflags);
+  ypd->ocount+=n;
+  return party!=1;
+}
+
 // Encodes a 2-input truth table for f(a,b) = (bool)(ttable&(1<<(2*a+b)))
 void yaoGenerateGate(ProtocolDesc* pd, OblivBit* r, char ttable,
     const OblivBit* a, const OblivBit* b)
@@ -1600,7 +3192,7 @@ void yaoGenerateHalfGatePair(ProtocolDesc* pd, OblivBit* r,
   block LA0, A1, LB0, B1;
   block H[4];
   block HLA0, HA1, HLB0, HB1;
-  memcpy((char*)&LA0, wa0, 16); memcpy((char*)&A1, wa1, 16); memcpy((char*)&LB0, wb0, 16); memcpy((char*)&B1, wb1, 16);
+  LA0 = yaoBitLoad(a); memcpy((char*)&A1, wa1, 16); LB0 = yaoBitLoad(b); memcpy((char*)&B1, wb1, 16);
   MITCCRH_renew_ks_if_needed_2_keys(&(ypd->proxy_mitccrh), ypd->gcount);
   MITCCRH_k2_h4(&(ypd->proxy_mitccrh), LA0, A1, LB0, B1, H);
   HLA0 = H[0];
@@ -1654,7 +3246,7 @@ void yaoEvaluateHalfGatePair(ProtocolDesc* pd, OblivBit* r,
   block A, B;
   block H[2];
   block HA, HB;
-  memcpy((char*)&A, a->yao.w, 16); memcpy((char*)&B, b->yao.w, 16);
+  A = yaoBitLoad(a); B = yaoBitLoad(b);
   MITCCRH_renew_ks_if_needed_2_keys(&(ypd->proxy_mitccrh), ypd->gcount);
   MITCCRH_k2_h2(&(ypd->proxy_mitccrh), A, B, H);
   HA = H[0];
@@ -1680,11 +3272,264 @@ void yaoEvaluateHalfGatePair(ProtocolDesc* pd, OblivBit* r,
   r->unknown = true;
 }
 
+// Batched forms of the two functions above, for n independent gates
+// r[i] = (a[i] xor ac)(b[i] xor bc) xor rc. Key schedules and gcount advance
+// exactly as n single-gate calls would, and the bytes on the wire are the
+// same too, so a batch on one side may meet single gates on the other.
+// r[i] may alias a[i] or b[i]
+#define YAO_HALFGATE_BATCH 256
+void yaoGenerateHalfGatePairs(ProtocolDesc* pd, OblivBit* r,
+    bool ac, bool bc, bool rc, const OblivBit* a, const OblivBit* b, size_t n)
+{
+  YaoProtocolDesc* ypd = pd->extra;
+  block in[4*YAO_HALFGATE_BATCH], H[4*YAO_HALFGATE_BATCH];
+  block rows[2*YAO_HALFGATE_BATCH];
+  block R,wg,we;
+  size_t i,m;
+  memcpy(&R,ypd->R,YAO_KEY_BYTES);
+  while(n>0)
+  { m = (n<YAO_HALFGATE_BATCH?n:YAO_HALFGATE_BATCH);
+    for(i=0;i<m;++i)
+    { in[4*i]=yaoBitLoad(&a[i]); in[4*i+1]=in[4*i]^R;
+      in[4*i+2]=yaoBitLoad(&b[i]); in[4*i+3]=in[4*i+2]^R;
+    }
+    MITCCRH_k2_h4_n(&(ypd->proxy_mitccrh),ypd->gcount,in,H,m);
+    for(i=0;i<m;++i)
+    { const block* h = H+4*i;
+      bool aci = (ac!=a[i].yao.inverted), bci = (bc!=b[i].yao.inverted);
+      bool pa = yaoKeyLsb(a[i].yao.w), pb = yaoKeyLsb(b[i].yao.w);
+      rows[2*i] = h[0]^h[1];
+      if(pb!=bci) rows[2*i]^=R;
+      wg = (pa?h[1]:h[0]);
+      if(((pa!=aci)&&(pb!=bci))!=rc) wg^=R;
+      rows[2*i+1] = h[2]^h[3]^in[4*i+aci];
+      we = (pb?h[3]:h[2]);
+      wg ^= we;
+      yaoBitStore(&r[i],wg);
+      r[i].yao.inverted = false; r[i].unknown = true;
+    }
+    ypd->gcount += 2*m;
+    osend(pd,2,rows,2*YAO_KEY_BYTES*m);
+    r+=m; a+=m; b+=m; n-=m;
+  }
+}
+
+void yaoEvaluateHalfGatePairs(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b, size_t n)
+{
+  YaoProtocolDesc* ypd = pd->extra;
+  block in[2*YAO_HALFGATE_BATCH], H[2*YAO_HALFGATE_BATCH];
+  block rows[2*YAO_HALFGATE_BATCH];
+  block wg,we;
+  size_t i,m;
+  while(n>0)
+  { m = (n<YAO_HALFGATE_BATCH?n:YAO_HALFGATE_BATCH);
+    for(i=0;i<m;++i)
+    { in[2*i]=yaoBitLoad(&a[i]);
+      in[2*i+1]=yaoBitLoad(&b[i]);
+    }
+    MITCCRH_k2_h2_n(&(ypd->proxy_mitccrh),ypd->gcount,in,H,m);
+    orecv(pd,1,rows,2*YAO_KEY_BYTES*m);
+    for(i=0;i<m;++i)
+    { wg = H[2*i];
+      if(yaoKeyLsb(a[i].yao.w)) wg^=rows[2*i];
+      we = H[2*i+1];
+      if(yaoKeyLsb(b[i].yao.w)) we^=rows[2*i+1]^in[2*i];
+      wg ^= we;
+      yaoBitStore(&r[i],wg);
+      r[i].unknown = true;
+    }
+    ypd->gcount += 2*m;
+    r+=m; a+=m; b+=m; n-=m;
+  }
+}
+
+void yaoGenerateAndPairs(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b, size_t n)
+  { yaoGenerateHalfGatePairs(pd,r,0,0,0,a,b,n); }
+
+void yaoGenerateOrPairs(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b, size_t n)
+  { yaoGenerateHalfGatePairs(pd,r,1,1,1,a,b,n); }
+
+// r = f xor c(t xor f). The xors are free, so all bits with unknown t and f
+// become a single batch of ANDs against c. c stays the first operand, as in
+// the generic ifThenElse, so the garbled rows match it
+#define YAO_MUX_BATCH 128
+void yaoMuxN(ProtocolDesc* pd, OblivBit* r, const OblivBit* t,
+    const OblivBit* f, size_t n, const OblivBit* c)
+{
+  OblivBit x[YAO_MUX_BATCH],cs[YAO_MUX_BATCH],xi;
+  size_t ind[YAO_MUX_BATCH],i,k,m;
+  for(i=0;i<YAO_MUX_BATCH;++i) cs[i]=*c; // also, r may alias c
+  while(n>0)
+  { m = (n<YAO_MUX_BATCH?n:YAO_MUX_BATCH);
+    for(i=k=0;i<m;++i)
+      if(t[i].unknown && f[i].unknown)
+      { yaoSetBitXor(pd,x+k,t+i,f+i); ind[k++]=i; }
+      else
+      { __obliv_c__setBitXor(&xi,t+i,f+i);
+        __obliv_c__setBitAnd(&xi,cs,&xi);
+        __obliv_c__setBitXor(r+i,&xi,f+i);
+      }
+    pd->setBitsAndN(pd,x,cs,x,k);
+    for(i=0;i<k;++i) yaoSetBitXor(pd,r+ind[i],x+i,f+ind[i]);
+    r+=m; t+=m; f+=m; n-=m;
+  }
+}
+
+/* Three-halves garbling (Rosulek and Roy, "Three Halves Make a Whole?").
+   Labels are handled as two 64-bit halves, and an AND gate costs three
+   half-ciphertexts G0..G2 plus one byte of encrypted control bits, instead
+   of the two full rows of half-gates. With input colors i,j and k=i^j, the
+   evaluator computes
+     C_L = H(A)_L ^ H(A^B)_L ^ i*G0 ^ k*G2 ^ R_ij,L.(A_L,A_R,B_L,B_R)
+     C_R = H(B)_L ^ H(A^B)_L ^ j*G1 ^ k*G2 ^ R_ij,R.(A_L,A_R,B_L,B_R)
+   where R_ij (low nibble for C_L) is yaoThreeHalvesBase[2i+j] plus
+   YAO_TH_V1/YAO_TH_V2 as selected by its two control bits.
+   The garbler looks up yaoThreeHalvesTab[8*alpha+4*beta+lambda], alpha and
+   beta being the values the color-0 labels stand for and lambda two fresh
+   random bits. g[] and c[] are masks over (A_L,A_R,B_L,B_R,R_L,R_R), A and B
+   the color-0 labels, that get added to G0..G2 and to the two halves of the
+   0-output label. ctrl has the control bits of color ij at bit 2(2i+j). For
+   each color they come out uniform whatever alpha and beta are, and they
+   travel masked with bits from the high halves of H(A) and H(B). */
+#define YAO_TH_GATE_BYTES (3*sizeof(uint64_t)+1)
+#define YAO_TH_V1 0xd6
+#define YAO_TH_V2 0x6b
+static const struct { uint8_t g[3],c[2],ctrl; } yaoThreeHalvesTab[16] = {
+  {{0x00,0x03,0x04},{0x04,0x04},0x00}, {{0x30,0x23,0x14},{0x02,0x09},0x55},
+  {{0x10,0x33,0x24},{0x0f,0x02},0xaa}, {{0x20,0x13,0x34},{0x09,0x0f},0xff},
+  {{0x2b,0x05,0x09},{0x09,0x0f},0x63}, {{0x1b,0x25,0x19},{0x0f,0x02},0x36},
+  {{0x3b,0x35,0x29},{0x02,0x09},0xc9}, {{0x0b,0x15,0x39},{0x04,0x04},0x9c},
+  {{0x06,0x1e,0x0f},{0x09,0x0f},0x87}, {{0x36,0x3e,0x1f},{0x0f,0x02},0xd2},
+  {{0x16,0x2e,0x2f},{0x02,0x09},0x2d}, {{0x26,0x0e,0x3f},{0x04,0x04},0x78},
+  {{0x2d,0x18,0x02},{0x14,0x24},0xe4}, {{0x1d,0x38,0x12},{0x12,0x29},0xb1},
+  {{0x3d,0x28,0x22},{0x1f,0x22},0x4e}, {{0x0d,0x08,0x32},{0x19,0x2f},0x1b},
+};
+static const uint8_t yaoThreeHalvesBase[4] = {0x44,0x30,0x00,0x74};
+
+static uint64_t yaoThreeHalvesDot(uint8_t m,const uint64_t* v,int n)
+{ uint64_t r=0;
+  int i;
+  for(i=0;i<n;++i) if(m&(1<<i)) r^=v[i];
+  return r;
+}
+// Control bit mask for color ij: unknown to the evaluator for any other color
+static int yaoThreeHalvesMask(block ha,block hb,int i,int j)
+  { return (((uint64_t)ha[1]>>(2*j))^((uint64_t)hb[1]>>(2*i)))&3; }
+
+static int yaoThreeHalvesLambda(YaoProtocolDesc* ypd)
+{ int rv;
+  if(ypd->thRandBits==0)
+  { gcry_randomize(&ypd->thRandPool,sizeof(ypd->thRandPool)
+                  ,GCRY_STRONG_RANDOM);
+    ypd->thRandBits = 8*sizeof(ypd->thRandPool);
+  }
+  rv = ypd->thRandPool&3;
+  ypd->thRandPool>>=2; ypd->thRandBits-=2;
+  return rv;
+}
+
+// Computes r = (a xor ac)(b xor bc) xor rc
+void yaoGenerateThreeHalvesPair(ProtocolDesc* pd, OblivBit* r,
+    bool ac, bool bc, bool rc, const OblivBit* a, const OblivBit* b)
+{
+  YaoProtocolDesc* ypd = pd->extra;
+  if(a->yao.inverted) ac=!ac;
+  if(b->yao.inverted) bc=!bc;
+
+  bool pa = yaoKeyLsb(a->yao.w), pb = yaoKeyLsb(b->yao.w);
+  int alpha = (pa!=ac), beta = (pb!=bc), i, j, row;
+  block A,B,D,C,H[6];
+  uint64_t v[6],g[3];
+  unsigned char gate[YAO_TH_GATE_BYTES], ctrl = 0;
+
+  memcpy(&D,ypd->R,YAO_KEY_BYTES);
+  A = yaoBitLoad(a); if(pa) A^=D;
+  B = yaoBitLoad(b); if(pb) B^=D;
+  MITCCRH_renew_ks_if_needed_3_keys(&(ypd->proxy_mitccrh), ypd->gcount);
+  MITCCRH_k3_h6(&(ypd->proxy_mitccrh), A, A^D, B, B^D, A^B, A^B^D, H);
+
+  row = 8*alpha+4*beta+yaoThreeHalvesLambda(ypd);
+  v[0]=A[0]; v[1]=A[1]; v[2]=B[0]; v[3]=B[1]; v[4]=D[0]; v[5]=D[1];
+  for(i=0;i<3;++i)
+    g[i] = H[2*i][0]^H[2*i+1][0]^yaoThreeHalvesDot(yaoThreeHalvesTab[row].g[i],v,6);
+  C[0] = H[0][0]^H[4][0]^yaoThreeHalvesDot(yaoThreeHalvesTab[row].c[0],v,6);
+  C[1] = H[2][0]^H[4][0]^yaoThreeHalvesDot(yaoThreeHalvesTab[row].c[1],v,6);
+  for(i=0;i<2;++i) for(j=0;j<2;++j)
+    ctrl |= (((yaoThreeHalvesTab[row].ctrl>>(2*(2*i+j)))&3)
+              ^yaoThreeHalvesMask(H[i],H[2+j],i,j)) << (2*(2*i+j));
+  memcpy(gate,g,sizeof(g));
+  gate[sizeof(g)] = ctrl;
+  osend(pd,2,gate,YAO_TH_GATE_BYTES);
+  ypd->gcount += 3;
+
+  if(rc) C^=D;
+  yaoBitStore(r,C);
+  r->yao.inverted = false; r->unknown = true;
+}
+
+void yaoGenerateThreeHalvesAnd(ProtocolDesc* pd, OblivBit* r,
+                               const OblivBit* a, const OblivBit* b)
+  { yaoGenerateThreeHalvesPair(pd,r,0,0,0,a,b); }
+
+void yaoGenerateThreeHalvesOr(ProtocolDesc* pd, OblivBit* r,
+                              const OblivBit* a, const OblivBit* b)
+  { yaoGenerateThreeHalvesPair(pd,r,1,1,1,a,b); }
+
+void yaoEvaluateThreeHalvesPair(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b)
+{
+  YaoProtocolDesc* ypd = pd->extra;
+  int i = yaoKeyLsb(a->yao.w), j = yaoKeyLsb(b->yao.w), k, R;
+  block A,B,C,H[3];
+  uint64_t v[4],g[3];
+  unsigned char gate[YAO_TH_GATE_BYTES];
+
+  A = yaoBitLoad(a);
+  B = yaoBitLoad(b);
+  MITCCRH_renew_ks_if_needed_3_keys(&(ypd->proxy_mitccrh), ypd->gcount);
+  MITCCRH_k3_h3(&(ypd->proxy_mitccrh), A, B, A^B, H);
+  orecv(pd,1,gate,YAO_TH_GATE_BYTES);
+  memcpy(g,gate,sizeof(g));
+
+  k = ((gate[sizeof(g)]>>(2*(2*i+j)))&3)^yaoThreeHalvesMask(H[0],H[1],i,j);
+  R = yaoThreeHalvesBase[2*i+j]^(k&1?YAO_TH_V1:0)^(k&2?YAO_TH_V2:0);
+  v[0]=A[0]; v[1]=A[1]; v[2]=B[0]; v[3]=B[1];
+  C[0] = H[0][0]^H[2][0]^(i?g[0]:0)^(i!=j?g[2]:0)^yaoThreeHalvesDot(R&0xf,v,4);
+  C[1] = H[1][0]^H[2][0]^(j?g[1]:0)^(i!=j?g[2]:0)^yaoThreeHalvesDot(R>>4,v,4);
+  ypd->gcount += 3;
+
+  yaoBitStore(r,C);
+  r->unknown = true;
+}
+
+// Offline/online split (execYaoProtocolPregarble/execYaoProtocolPregarbled).
+//   Sits in YaoProtocolDesc.extra during the online phase, and in the
+//   generator's offline run.
+typedef struct
+{ char protoType;
+  ProtocolTransport* tables;  // garbled tables: written offline, read by the
+                              //   online evaluator
+  ProtocolTransport* secrets; // generator only: R, I, start point, and the
+                              //   flip bits of every output
+  yao_key_t R,I;
+  block start;
+} YaoPregarbled;
+static OC_DYN_EXTRA_FUN(ypdPregarbled,YaoProtocolDesc,
+                        YaoPregarbled,OC_YPD_TYPE_PREGARBLED)
+
 uint64_t yaoGateCount()
-{ uint64_t rv = ((YaoProtocolDesc*)currentProto->extra)->gcount - ((YaoProtocolDesc*)currentProto->extra)->gcount_offset;
+{ YaoProtocolDesc* ypd = currentProto->extra;
+  uint64_t rv = ypd->gcount - ypd->gcount_offset;
   if(currentProto->setBitAnd==yaoGenerateAndPair
-      || currentProto->setBitAnd==yaoEvaluateHalfGatePair) // halfgate
+      || currentProto->setBitAnd==yaoEvaluateHalfGatePair // halfgate
+      || (ypd->extra && ypdPregarbled(ypd)))
     return rv/2;
+  else if(currentProto->setBitAnd==yaoGenerateThreeHalvesAnd
+      || currentProto->setBitAnd==yaoEvaluateThreeHalvesPair)
+    return rv/3;
   else return rv;
 }
 
@@ -1731,6 +3576,8 @@ void splitYaoProtocolExtra(ProtocolDesc* pdout, ProtocolDesc * pdin) {
   ypdout->ownOT = true; // For now we don't do anything special for OT on forked protocols
   
   ypdout->halfgates = ypdin->halfgates;
+  ypdout->thRandBits = 0;
+  AESCTR_init(&ypdout->label_prg);
   setupYaoFixedKeyCipher(pdout);
   if(ypdout->halfgates == 1){
   	MITCCRH_init(&(ypdout->proxy_mitccrh));
@@ -1739,6 +3586,7 @@ void splitYaoProtocolExtra(ProtocolDesc* pdout, ProtocolDesc * pdin) {
   if (pdout->thisParty == 1) {
     memcpy(ypdout->R,ypdin->R,YAO_KEY_BYTES);
     gcry_randomize(ypdout->I,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
+    AESCTR_setKey(&ypdout->label_prg,yaoKeyToBlock(ypdout->I));
     gcry_randomize(&ypdout->gcount_offset,sizeof(ypdout->gcount_offset),GCRY_STRONG_RANDOM);
     osend(pdout,2,&ypdout->gcount_offset,sizeof(ypdout->gcount_offset));
     ypdout->sender = honestOTExtSenderAbstract(honestOTExtSenderNew(pdout,2));
@@ -1763,9 +3611,8 @@ void splitYaoProtocolExtra(ProtocolDesc* pdout, ProtocolDesc * pdin) {
   oflush(pdin); oflush(pdout);
 }
 
-/* execYaoProtocol is divided into 2 parts which are reused by other
-   protocols such as DualEx */
-void setupYaoProtocol(ProtocolDesc* pd,bool halfgates)
+// Everything setupYaoProtocol does that does not talk to the other party
+static void setupYaoProtocolLocal(ProtocolDesc* pd,bool halfgates)
 {
   YaoProtocolDesc* ypd = malloc(sizeof(YaoProtocolDesc));
   int me = pd->thisParty;
@@ -1777,13 +3624,21 @@ void setupYaoProtocol(ProtocolDesc* pd,bool halfgates)
   pd->currentParty = ocCurrentPartyDefault;
   pd->feedOblivInputs = (me==1?yaoGenrFeedOblivInputs:yaoEvalFeedOblivInputs);
   pd->revealOblivBits = (me==1?yaoGenrRevealOblivBits:yaoEvalRevealOblivBits);
+  pd->revealOblivBitsN = (me==1?yaoGenrRevealOblivBitsN
+                               :yaoEvalRevealOblivBitsN);
   if(halfgates)
   { pd->setBitAnd = (me==1?yaoGenerateAndPair:yaoEvaluateHalfGatePair);
     pd->setBitOr  = (me==1?yaoGenerateOrPair :yaoEvaluateHalfGatePair);
+    pd->setBitsAndN = (me==1?yaoGenerateAndPairs:yaoEvaluateHalfGatePairs);
+    pd->setBitsOrN  = (me==1?yaoGenerateOrPairs :yaoEvaluateHalfGatePairs);
+    pd->muxN        = yaoMuxN;
   }else
   { ypd->nonFreeGate = (me==1?yaoGenerateGate:yaoEvaluateGate);
     pd->setBitAnd = yaoSetBitAnd;
     pd->setBitOr  = yaoSetBitOr;
+    pd->setBitsAndN = NULL;
+    pd->setBitsOrN  = NULL;
+    pd->muxN        = NULL;
   }
   pd->setBitXor = yaoSetBitXor;
   pd->setBitNot = yaoSetBitNot;
@@ -1793,31 +3648,47 @@ void setupYaoProtocol(ProtocolDesc* pd,bool halfgates)
   else ypd->recver.recver=NULL;
 
   dhRandomInit();
-  setupYaoFixedKeyCipher(pd);
 
   pd->splitextra = splitYaoProtocolExtra;
   pd->cleanextra = cleanupYaoProtocol;
   
   ypd->halfgates = halfgates;
+  ypd->thRandBits = 0;
+  AESCTR_init(&ypd->label_prg);
   if(halfgates == 1){
 	  MITCCRH_init(&(ypd->proxy_mitccrh));
   }
 }
 
+/* execYaoProtocol is divided into 2 parts which are reused by other
+   protocols such as DualEx */
+void setupYaoProtocol(ProtocolDesc* pd,bool halfgates)
+{
+  setupYaoProtocolLocal(pd,halfgates);
+  setupYaoFixedKeyCipher(pd);
+}
+
 // point_and_permute should always be true.
 // It is false only in the NP protocol, where evaluator knows everything
 void mainYaoProtocol(ProtocolDesc* pd, bool point_and_permute,
                      protocol_run start, void* arg)
 {
   YaoProtocolDesc* ypd = pd->extra;
+  YaoPregarbled* pg = (ypd->extra?ypdPregarbled(ypd):NULL);
   int me = pd->thisParty;
   ypd->ownOT=false;
   ypd->gcount = ypd->gcount_offset = ypd->icount = ypd->ocount = 0;
   if(me==1)
   {
-    gcry_randomize(ypd->R,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
-    gcry_randomize(ypd->I,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
-    if(point_and_permute) ypd->R[0] |= 1;   // flipper bit
+    if(pg && pg->secrets) // keys were fixed when the tables were garbled
+    { yaoKeyCopy(ypd->R,pg->R);
+      yaoKeyCopy(ypd->I,pg->I);
+    }else
+    { gcry_randomize(ypd->R,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
+      gcry_randomize(ypd->I,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
+      if(point_and_permute) ypd->R[0] |= 1;   // flipper bit
+    }
+    AESCTR_setKey(&ypd->label_prg,yaoKeyToBlock(ypd->I));
 
     if(ypd->sender.sender==NULL)
     { ypd->ownOT=true;
@@ -1832,7 +3703,8 @@ void mainYaoProtocol(ProtocolDesc* pd, bool point_and_permute,
     
   if(me == 1){
   	block mitccrh_start_point;
-  	gcry_randomize((char*)&mitccrh_start_point, 16, GCRY_STRONG_RANDOM);
+  	if(pg && pg->secrets) mitccrh_start_point = pg->start;
+  	else gcry_randomize((char*)&mitccrh_start_point, 16, GCRY_STRONG_RANDOM);
   	
   	osend(pd, 2, &mitccrh_start_point, 16);
   	MITCCRH_setS(&(ypd->proxy_mitccrh), mitccrh_start_point);
@@ -1846,10 +3718,34 @@ void mainYaoProtocol(ProtocolDesc* pd, bool point_and_permute,
   start(arg);
 }
 
+bool yaoOTPoolStart(ProtocolDesc* pd, size_t depth)
+{
+  YaoProtocolDesc* ypd = protoYaoProtocolDesc(pd);
+  if(!ypd || !ypd->ownOT) return false; // not necessarily OT extension
+  if(pd->thisParty==1)
+    return honestOTExtSenderPoolStart(ypd->sender.sender,depth);
+  else return honestOTExtRecverPoolStart(ypd->recver.recver,depth);
+}
+void yaoOTPoolPrefill(ProtocolDesc* pd, size_t n)
+{
+  YaoProtocolDesc* ypd = protoYaoProtocolDesc(pd);
+  if(!ypd || !ypd->ownOT) return;
+  if(pd->thisParty==1) honestOTExtSenderPoolPrefill(ypd->sender.sender,n);
+  else honestOTExtRecverPoolPrefill(ypd->recver.recver,n);
+}
+size_t yaoOTPoolDepth(ProtocolDesc* pd)
+{
+  YaoProtocolDesc* ypd = protoYaoProtocolDesc(pd);
+  if(!ypd || !ypd->ownOT) return 0;
+  if(pd->thisParty==1) return honestOTExtSenderPoolDepth(ypd->sender.sender);
+  else return honestOTExtRecverPoolDepth(ypd->recver.recver);
+}
+
 void cleanupYaoProtocol(ProtocolDesc* pd)
 {
   YaoProtocolDesc* ypd = pd->extra;
   gcry_cipher_close(ypd->fixedKeyCipher);
+  AESCTR_release(&ypd->label_prg);
   yaoReleaseOt(pd, pd->thisParty);
   free(ypd);
   pd->extra = NULL;
@@ -1869,6 +3765,311 @@ void execYaoProtocol_noHalf(ProtocolDesc* pd, protocol_run start, void* arg)
   cleanupYaoProtocol(pd);
 }
 
+// Same as execYaoProtocol, but sends (and over tcp2P, receives) on separate
+//   threads, so a session can keep two cores busy on one circuit
+void execYaoProtocol_pipelined(ProtocolDesc* pd, protocol_run start, void* arg)
+{
+  setupYaoProtocol(pd,true);
+  protocolAddPipelining(pd);
+  mainYaoProtocol(pd,true,start,arg);
+  protocolRemovePipelining(pd);
+  cleanupYaoProtocol(pd);
+}
+
+// Same as execYaoProtocol, with 25-byte three-halves AND gates instead of
+// 32-byte half-gates. Both parties have to use it.
+void execYaoProtocol_threeHalves(ProtocolDesc* pd, protocol_run start,
+                                 void* arg)
+{
+  int me = pd->thisParty;
+  setupYaoProtocol(pd,true);
+  pd->setBitAnd = (me==1?yaoGenerateThreeHalvesAnd:yaoEvaluateThreeHalvesPair);
+  pd->setBitOr  = (me==1?yaoGenerateThreeHalvesOr :yaoEvaluateThreeHalvesPair);
+  pd->setBitsAndN = NULL;
+  pd->setBitsOrN  = NULL;
+  pd->muxN        = NULL;
+  mainYaoProtocol(pd,true,start,arg);
+  cleanupYaoProtocol(pd);
+}
+
+// ------------------------ Pre-garbled Yao --------------------------------
+// The generator garbles the whole circuit ahead of time, with no peer, into a
+//   table file that is later copied to the evaluator. Online, the generator
+//   only feeds inputs and helps with reveals, while the evaluator streams the
+//   tables from its local copy instead of the network. The generator also
+//   keeps a private secrets file (R, I and the output flip bits): it must
+//   never leave the generator's machine, and each pair of files is good for
+//   exactly one online run.
+// Restrictions: the circuit (control flow, input sizes, number of reveals)
+//   has to be the same offline and online, which obliv-c programs that do not
+//   branch on revealed values already guarantee. Half-gates only, and no
+//   ocSplitProto or special-purpose gates (yaoGenerateGenHalf etc.).
+
+#define YAO_TABLE_FILE_CHUNK (1<<24)
+static const char yaoTableMagic[8]  ="OCYAOGT1";
+static const char yaoSecretMagic[8] ="OCYAOGS1";
+
+// A ProtocolTransport over an mmap'ed file. Writers append (growing the file
+//   as needed), readers consume from the start. Channel numbers are ignored.
+typedef struct
+{ ProtocolTransport cb;
+  int fd;
+  bool writing;
+  char* map;
+  size_t len,cap,pos; // bytes of data, bytes mapped, read position
+} yaoTableFile;
+
+static int yaoTableFileSend(ProtocolTransport* pt,int dest,
+                            const void* s,size_t n)
+{ yaoTableFile* t = CAST(pt);
+  if(t->len+n>t->cap)
+  { size_t cap = t->cap+YAO_TABLE_FILE_CHUNK;
+    char* map;
+    while(cap<t->len+n) cap+=YAO_TABLE_FILE_CHUNK;
+    if(ftruncate(t->fd,cap)<0) return -1;
+    map = mmap(NULL,cap,PROT_READ|PROT_WRITE,MAP_SHARED,t->fd,0);
+    if(map==MAP_FAILED) return -1;
+    if(t->map) munmap(t->map,t->cap);
+    t->map=map; t->cap=cap;
+  }
+  memcpy(t->map+t->len,s,n);
+  t->len+=n;
+  return n;
+}
+static int yaoTableFileRecv(ProtocolTransport* pt,int src,void* s,size_t n)
+{ yaoTableFile* t = CAST(pt);
+  if(t->pos+n>t->len)
+  { fprintf(stderr,"Pre-garbled file too short: circuit changed since "
+                   "it was garbled?\n");
+    return -1;
+  }
+  memcpy(s,t->map+t->pos,n);
+  t->pos+=n;
+  return n;
+}
+static void yaoTableFileCleanup(ProtocolTransport* pt)
+{ yaoTableFile* t = CAST(pt);
+  if(t->map) munmap(t->map,t->cap);
+  if(t->writing && ftruncate(t->fd,t->len)<0)
+    fprintf(stderr,"Could not truncate pre-garbled file: %s\n",strerror(errno));
+  close(t->fd);
+  free(t);
+}
+static ProtocolTransport* yaoTableFileOpen(const char* path,bool writing,
+                                           const char magic[8])
+{ yaoTableFile* t;
+  struct stat st;
+  int fd = (writing?open(path,O_RDWR|O_CREAT|O_TRUNC,0600):open(path,O_RDONLY));
+  if(fd<0) return NULL;
+  t = calloc(1,sizeof(*t));
+  t->cb = (ProtocolTransport){.maxParties=2, .split=NULL,
+                              .send=yaoTableFileSend, .recv=yaoTableFileRecv,
+                              .flush=NULL, .cleanup=yaoTableFileCleanup};
+  t->fd = fd;
+  t->writing = writing;
+  if(writing) yaoTableFileSend(&t->cb,0,magic,8);
+  else
+  { if(fstat(fd,&st)<0 || st.st_size<8) { close(fd); free(t); return NULL; }
+    t->len = t->cap = st.st_size;
+    // read it all in now, so page faults don't stall the online phase
+    t->map = mmap(NULL,t->cap,PROT_READ,MAP_PRIVATE|MAP_POPULATE,fd,0);
+    if(t->map==MAP_FAILED || memcmp(t->map,magic,8))
+    { if(t->map!=MAP_FAILED) munmap(t->map,t->cap);
+      close(fd); free(t);
+      return NULL;
+    }
+    t->pos = 8;
+  }
+  return &t->cb;
+}
+
+static YaoPregarbled* protoPregarbled(ProtocolDesc* pd)
+  { return ((YaoProtocolDesc*)pd->extra)->extra; }
+
+// Offline: labels only. There is nobody to send them to, and online the
+//   generator recomputes the same ones from I.
+static void yaoPregarbleFeedOblivInputs(ProtocolDesc* pd,
+                                        OblivInputs* oi,size_t n,int src)
+{
+  YaoProtocolDesc* ypd = pd->extra;
+  OIBitSrc it = oiBitSrc(oi,n);
+  size_t bc = bitCount(&it), m, i;
+  block w0[YAO_LABEL_BATCH];
+  while(hasBit(&it))
+  { m = (bc<YAO_LABEL_BATCH?bc:YAO_LABEL_BATCH);
+    yaoKeyNewLabels(ypd,w0,m); // does ypd->icount+=m
+    for(i=0;i<m;++i,nextBit(&it))
+    { OblivBit* o = curDestBit(&it);
+      o->yao.inverted = false; o->unknown = true;
+      yaoBitStore(o,w0[i]);
+    }
+    bc-=m;
+  }
+}
+// Offline: save what the online reveal will need. The value itself is not
+//   known yet, so report it as not revealed.
+static bool yaoPregarbleRevealOblivBitsN(ProtocolDesc* pd,
+    char* dest,const OblivBit* o,size_t n,int party)
+{
+  size_t i,bc=(n+7)/8;
+  char *flipflags = calloc(bc,1);
+  for(i=0;i<n;++i) if(o[i].unknown)
+    xorBit(flipflags,i,yaoKeyLsb(o[i].yao.w) != o[i].yao.inverted);
+  transSend(protoPregarbled(pd)->secrets,0,flipflags,bc);
+  free(flipflags);
+  ((YaoProtocolDesc*)pd->extra)->ocount+=n;
+  return false;
+}
+static bool yaoPregarbleRevealOblivBits(ProtocolDesc* pd,
+    widest_t* dest,const OblivBit* o,size_t n,int party)
+  { return yaoPregarbleRevealOblivBitsN(pd,NULL,o,n,party); }
+
+// Online generator: the gates are already garbled, and the labels on its
+//   side of the circuit do not matter anymore. Only the flip bits saved
+//   offline do.
+static void yaoPregarbledSkipGate(ProtocolDesc* pd,OblivBit* r,
+    const OblivBit* a,const OblivBit* b)
+{
+  yaoKeyZero(r->yao.w);
+  r->yao.inverted = false;
+  r->unknown = true;
+  ((YaoProtocolDesc*)pd->extra)->gcount+=2;
+}
+static void yaoPregarbledSkipGates(ProtocolDesc* pd,OblivBit* r,
+    const OblivBit* a,const OblivBit* b,size_t n)
+  { size_t i; for(i=0;i<n;++i) yaoPregarbledSkipGate(pd,r+i,a+i,b+i); }
+static bool yaoPregarbledGenrRevealOblivBitsN(ProtocolDesc* pd,
+    char* dest,const OblivBit* o,size_t n,int party)
+{
+  size_t bc=(n+7)/8;
+  char *flipflags = malloc(bc);
+  bool rv;
+  transRecv(protoPregarbled(pd)->secrets,0,flipflags,bc);
+  rv = yaoGenrRevealFlipflags(pd,dest,o,n,party,flipflags);
+  free(flipflags);
+  return rv;
+}
+static bool yaoPregarbledGenrRevealOblivBits(ProtocolDesc* pd,
+    widest_t* dest,const OblivBit* o,size_t n,int party)
+{
+  widest_t rv=0; // Assuming little endian
+  if(!yaoPregarbledGenrRevealOblivBitsN(pd,(char*)&rv,o,n,party))
+    return false;
+  *dest=rv;
+  return true;
+}
+
+// Online evaluator: regular half-gate evaluation, tables from the file
+static void yaoPregarbledEvalGate(ProtocolDesc* pd,OblivBit* r,
+    const OblivBit* a,const OblivBit* b)
+{
+  ProtocolTransport* t = pd->trans;
+  pd->trans = protoPregarbled(pd)->tables;
+  yaoEvaluateHalfGatePair(pd,r,a,b);
+  pd->trans = t;
+}
+static void yaoPregarbledEvalGates(ProtocolDesc* pd,OblivBit* r,
+    const OblivBit* a,const OblivBit* b,size_t n)
+{
+  ProtocolTransport* t = pd->trans;
+  pd->trans = protoPregarbled(pd)->tables;
+  yaoEvaluateHalfGatePairs(pd,r,a,b,n);
+  pd->trans = t;
+}
+
+// Offline phase, run by the generator alone. Calls start(arg) with party 1
+//   inputs as usual; party 2 inputs can be anything of the right size.
+//   Revealed values are not available (revealOblivInt etc. return false).
+//   Returns 0 on success, -1 if either file could not be created.
+int execYaoProtocolPregarble(const char* tablePath,const char* secretPath,
+                             protocol_run start,void* arg)
+{
+  ProtocolDesc pd;
+  YaoProtocolDesc* ypd;
+  YaoPregarbled* pg;
+  pd.thisParty = 1;
+  if(!(pd.trans = yaoTableFileOpen(tablePath,true,yaoTableMagic))) return -1;
+  pg = calloc(1,sizeof(*pg));
+  pg->protoType = OC_YPD_TYPE_PREGARBLED;
+  pg->tables = pd.trans;
+  if(!(pg->secrets = yaoTableFileOpen(secretPath,true,yaoSecretMagic)))
+  { pd.trans->cleanup(pd.trans); free(pg); return -1; }
+
+  setupYaoProtocolLocal(&pd,true);
+  ypd = pd.extra;
+  ypd->extra = pg;
+  ypd->fixedKeyCipher = NULL; // only used by non-half-gates
+  ypd->ownOT = false;
+  pd.feedOblivInputs  = yaoPregarbleFeedOblivInputs;
+  pd.revealOblivBits  = yaoPregarbleRevealOblivBits;
+  pd.revealOblivBitsN = yaoPregarbleRevealOblivBitsN;
+
+  gcry_randomize(pg->R,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
+  gcry_randomize(pg->I,YAO_KEY_BYTES,GCRY_STRONG_RANDOM);
+  gcry_randomize((char*)&pg->start,16,GCRY_STRONG_RANDOM);
+  pg->R[0] |= 1;   // flipper bit
+  transSend(pg->secrets,0,pg->R,YAO_KEY_BYTES);
+  transSend(pg->secrets,0,pg->I,YAO_KEY_BYTES);
+  transSend(pg->secrets,0,&pg->start,16);
+  yaoKeyCopy(ypd->R,pg->R);
+  yaoKeyCopy(ypd->I,pg->I);
+  AESCTR_setKey(&ypd->label_prg,yaoKeyToBlock(ypd->I));
+  ypd->gcount = ypd->gcount_offset = ypd->icount = ypd->ocount = 0;
+  MITCCRH_setS(&(ypd->proxy_mitccrh),pg->start);
+
+  currentProto = &pd;
+  start(arg);
+
+  pg->secrets->cleanup(pg->secrets);
+  free(pg);
+  ypd->extra = NULL;
+  cleanupProtocol(&pd); // closes the table file too
+  return 0;
+}
+
+// Online phase. Both parties call it over a regular connection, with the
+//   same start(arg) as offline. path is the secrets file for the generator
+//   and (a copy of) the table file for the evaluator.
+//   Returns 0 on success, -1 if the file is missing or of the wrong kind.
+int execYaoProtocolPregarbled(ProtocolDesc* pd,const char* path,
+                              protocol_run start,void* arg)
+{
+  int me = pd->thisParty;
+  YaoProtocolDesc* ypd;
+  YaoPregarbled* pg;
+  ProtocolTransport* f =
+    yaoTableFileOpen(path,false,me==1?yaoSecretMagic:yaoTableMagic);
+  if(!f) return -1;
+  pg = calloc(1,sizeof(*pg));
+  pg->protoType = OC_YPD_TYPE_PREGARBLED;
+  if(me==1)
+  { pg->secrets = f;
+    transRecv(f,0,pg->R,YAO_KEY_BYTES);
+    transRecv(f,0,pg->I,YAO_KEY_BYTES);
+    transRecv(f,0,&pg->start,16);
+  }else pg->tables = f;
+
+  setupYaoProtocol(pd,true);
+  ypd = pd->extra;
+  ypd->extra = pg;
+  if(me==1)
+  { pd->setBitAnd   = pd->setBitOr   = yaoPregarbledSkipGate;
+    pd->setBitsAndN = pd->setBitsOrN = yaoPregarbledSkipGates;
+    pd->revealOblivBits  = yaoPregarbledGenrRevealOblivBits;
+    pd->revealOblivBitsN = yaoPregarbledGenrRevealOblivBitsN;
+  }else
+  { pd->setBitAnd   = pd->setBitOr   = yaoPregarbledEvalGate;
+    pd->setBitsAndN = pd->setBitsOrN = yaoPregarbledEvalGates;
+  }
+  mainYaoProtocol(pd,true,start,arg);
+
+  f->cleanup(f);
+  free(pg);
+  ypd->extra = NULL;
+  cleanupYaoProtocol(pd);
+  return 0;
+}
+
 // Special purpose gates, meant to be used if you like doing low-level
 // optimizations. Note: this one assumes constant propagation has already
 // been done, and 'a' is private to the generator.
@@ -1916,7 +4117,7 @@ void yaoEvaluateGenHalf(ProtocolDesc* pd,OblivBit* r,const OblivBit* a)
   block A;
   block H[1];
   block HA;
-  memcpy((char*)&A, a->yao.w, 16);
+  A = yaoBitLoad(a);
   MITCCRH_renew_ks_if_needed(&(ypd->proxy_mitccrh), ypd->gcount);
   MITCCRH_k1_h1(&(ypd->proxy_mitccrh), A, H);
   HA = H[0];
@@ -2091,11 +4292,15 @@ void setupNnobProtocol(ProtocolDesc* pd) {
   pd->currentParty = ocCurrentPartyDefault;
   pd->feedOblivInputs = nnobFeedOblivInputs;
   pd->revealOblivBits = nnobRevealOblivInputs;
+  pd->revealOblivBitsN = NULL;
   pd->setBitAnd = nnobSetBitAnd;
   pd->setBitOr  = nnobSetBitOr;
   pd->setBitXor = nnobSetBitXor;
   pd->setBitNot = nnobSetBitNot;
   pd->flipBit   = nnobFlipBit;
+  pd->setBitsAndN = NULL;
+  pd->setBitsOrN  = NULL;
+  pd->muxN        = NULL;
 }
 
 
@@ -2271,6 +4476,28 @@ bool __obliv_c__revealOblivBits (widest_t* dest, const OblivBit* src
                                 ,size_t size, int party)
   { return currentProto->revealOblivBits(currentProto,dest,src,size,party); }
 
+#define MAX_REVEAL_BITS (8*sizeof(widest_t))
+// dest is char[(size+7)/8]. Falls back to widest_t-sized chunks if the
+// protocol has no bulk reveal
+bool __obliv_c__revealOblivBitsN (char* dest, const OblivBit* src
+                                 ,size_t size, int party)
+{
+  size_t i;
+  widest_t wd;
+  bool rv = false;
+  if(size==0) return true; // as the old one-element-at-a-time loops did
+  if(currentProto->revealOblivBitsN)
+    return currentProto->revealOblivBitsN(currentProto,dest,src,size,party);
+  for(i=0;i<size;i+=MAX_REVEAL_BITS)
+  { size_t n = (size-i<MAX_REVEAL_BITS?size-i:MAX_REVEAL_BITS);
+    if(currentProto->revealOblivBits(currentProto,&wd,src+i,n,party))
+    { memcpy(dest+i/8,&wd,(n+7)/8); // Assuming little endian
+      rv = true;
+    }
+  }
+  return rv;
+}
+
 void __obliv_c__setSignedKnown
   (void* vdest, size_t size, long long signed value)
 {
@@ -2324,15 +4551,45 @@ void bitwiseOp(OblivBit* dest,const OblivBit* a,const OblivBit* b,size_t size
   { while(size-->0) f(dest++,a++,b++); }
 
 
+// dest[i] = a[i*astep] AND/OR b[i*bstep]. Known bits are resolved in place,
+// the rest are gathered for the protocol's setBitsAndN/OrN, if it has one.
+// Operand order is kept, since half-gates garble a AND b and b AND a
+// differently
+#define GATE_BATCH 128
+static void bitwiseAndOr(OblivBit* dest,const OblivBit* a,size_t astep
+                        ,const OblivBit* b,size_t bstep,size_t size,bool isOr)
+{
+  OblivBit ta[GATE_BATCH],tb[GATE_BATCH];
+  size_t ind[GATE_BATCH],i,j,m,n;
+  void (*f)(OblivBit*,const OblivBit*,const OblivBit*)
+    = (isOr?__obliv_c__setBitOr:__obliv_c__setBitAnd);
+  void (*fn)(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*,size_t)
+    = (isOr?currentProto->setBitsOrN:currentProto->setBitsAndN);
+  if(!fn)
+  { for(i=0;i<size;++i) f(dest+i,a+i*astep,b+i*bstep);
+    return;
+  }
+  while(size>0)
+  { n = (size<GATE_BATCH?size:GATE_BATCH);
+    for(i=m=0;i<n;++i)
+      if(known(a+i*astep) || known(b+i*bstep))
+        f(dest+i,a+i*astep,b+i*bstep);
+      else { ta[m]=a[i*astep]; tb[m]=b[i*bstep]; ind[m++]=i; }
+    fn(currentProto,ta,ta,tb,m);
+    for(j=0;j<m;++j) dest[ind[j]]=ta[j];
+    dest+=n; a+=n*astep; b+=n*bstep; size-=n;
+  }
+}
+
 void __obliv_c__setBitwiseAnd (void* vdest
                               ,const void* vop1,const void* vop2
                               ,size_t size)
-  { bitwiseOp(vdest,vop1,vop2,size,__obliv_c__setBitAnd); }
+  { bitwiseAndOr(vdest,vop1,1,vop2,1,size,false); }
 
 void __obliv_c__setBitwiseOr  (void* vdest
                               ,const void* vop1,const void* vop2
                               ,size_t size)
-  { bitwiseOp(vdest,vop1,vop2,size,__obliv_c__setBitOr); }
+  { bitwiseAndOr(vdest,vop1,1,vop2,1,size,true); }
 
 void __obliv_c__setBitwiseXor (void* vdest
                               ,const void* vop1,const void* vop2
@@ -2639,14 +4896,24 @@ void __obliv_c__ifThenElse (void* vdest, const void* vtsrc
                            ,const void* vcond)
 {
   // copying out vcond because it could be aliased by vdest
-  OblivBit x,a,c=*(const OblivBit*)vcond;
+  OblivBit x[GATE_BATCH],a[GATE_BATCH],c=*(const OblivBit*)vcond;
   OblivBit *dest=vdest;
   const OblivBit *tsrc=vtsrc, *fsrc=vfsrc;
-  while(size-->0)
-  { __obliv_c__setBitXor(&x,tsrc,fsrc);
-    __obliv_c__setBitAnd(&a,&c,&x);
-    __obliv_c__setBitXor(dest,&a,fsrc);
-    ++dest; ++fsrc; ++tsrc;
+  size_t i,n;
+  if(known(&c))
+  { __obliv_c__copyBits(dest,(c.knownValue?tsrc:fsrc),size);
+    return;
+  }
+  if(currentProto->muxN)
+  { currentProto->muxN(currentProto,dest,tsrc,fsrc,size,&c);
+    return;
+  }
+  while(size>0)
+  { n = (size<GATE_BATCH?size:GATE_BATCH);
+    for(i=0;i<n;++i) __obliv_c__setBitXor(x+i,tsrc+i,fsrc+i);
+    bitwiseAndOr(a,&c,0,x,1,n,false);
+    for(i=0;i<n;++i) __obliv_c__setBitXor(dest+i,a+i,fsrc+i);
+    dest+=n; fsrc+=n; tsrc+=n; size-=n;
   }
 }
 
@@ -2858,12 +5125,16 @@ bool revealOblivBool(bool * dest, __obliv_c__bool src, int party)
 }
 bool revealOblivBoolArray(bool *dest, const __obliv_c__bool * src,
                               size_t n, int party)
-{ bool rv = true;
-  for (size_t ii = 0; ii < n; ii++)
-    { rv &= revealOblivBool(&dest[ii], src[ii], party); }
+{ size_t ii;
+  char *buf = malloc((n+7)/8);
+  bool rv = __obliv_c__revealOblivBitsN(buf,(const OblivBit*)src,n,party);
+  if(rv) for (ii = 0; ii < n; ii++) dest[ii] = getBit(buf,ii);
+  free(buf);
   return rv;
 }
 
+// Packed bits are laid out exactly like a little endian t[n], so the bulk
+// reveal writes straight into dest
 #define revealOblivFun(t, ot, tname) \
       bool revealObliv##tname(t * dest, __obliv_c__##ot src, int party) \
       { widest_t wd; \
@@ -2873,14 +5144,8 @@ bool revealOblivBoolArray(bool *dest, const __obliv_c__bool * src,
       } \
       bool revealObliv##tname##Array(t *dest, const __obliv_c__##ot * src,\
                                     size_t n, int party) \
-      { bool rv = true; \
-        if(party!=1) \
-          for (size_t ii = 0; ii < n; ii++) \
-            { rv &= revealObliv##tname(&dest[ii], src[ii], 2); } \
-        if(party!=2) \
-          for (size_t ii = 0; ii < n; ii++) \
-            { rv &= revealObliv##tname(&dest[ii], src[ii], 1); } \
-        return rv; \
+      { return __obliv_c__revealOblivBitsN((char*)dest,(const OblivBit*)src,\
+                                           n*__bitsize(t),party); \
       }
 
 revealOblivFun(char,char,Char);
@@ -28,7 +28,8 @@ static inline OblivBit* __obliv_c__bits(void* x) { return x; }
 
 #define ocBitSize(type) (sizeof(type)/sizeof(__obliv_c__bool))
 
-static const __obliv_c__bool __obliv_c__trueCond = {{{false,{true}}}};
+static const __obliv_c__bool __obliv_c__trueCond
+  = {{{.unknown=false,.knownValue=true}}};
 
 // None of the __obliv_c__* functions are meant to be used directly
 //   in a normal C program, but rather through an obliv-c program.
@@ -56,6 +57,10 @@ void __obliv_c__setBitsKnown(OblivBit* dest, const bool* value, size_t size);
 void __obliv_c__copyBits(OblivBit* dest, const OblivBit* src, size_t size);
 // allBitsKnown leave dest in an unspecified state if all bits are not known
 bool __obliv_c__allBitsKnown(const OblivBit* bits, bool* dest, size_t size);
+// dest is char[(size+7)/8], bits packed little endian. Any size works,
+//   unlike revealOblivBits which is limited to widest_t
+bool __obliv_c__revealOblivBitsN(char* dest, const OblivBit* src
+                                ,size_t size, int party);
 
 void __obliv_c__setBitwiseAnd (void* dest
                               ,const void* op1,const void* op2
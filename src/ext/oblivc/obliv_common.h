@@ -2,8 +2,6 @@
 #define OBLIV_COMMON_H
 
 #include<obliv_types.h>
-//#include<stdio.h>
-//FILE* transGetFile(ProtocolTransport* t); // Debugging API
 
 // Because I am evil and I do not like
 // Java-style redundant "say the type twice" practice
@@ -96,6 +94,37 @@ void honestOTExtSend1Of2Chunk(void* vargs,char* opt0,char* opt1,int nchunk,
     int len,OcOtCorrelator f,void* corrArg);
 void honestOTExtSend1Of2Skip(void* vargs);
 void honestOTExtSend1Of2Skip(void* vargs);
+// Random OT pool, for messages of up to 16 bytes: a thread on a split
+//   connection keeps depth random OTs ready, and honestOTExt{Send,Recv}1Of2
+//   just derandomize them. Both parties call these at matching points.
+//   Start returns false if the transport cannot be split.
+bool honestOTExtSenderPoolStart(struct HonestOTExtSender* s,size_t depth);
+bool honestOTExtRecverPoolStart(struct HonestOTExtRecver* r,size_t depth);
+void honestOTExtSenderPoolPrefill(struct HonestOTExtSender* s,size_t n);
+void honestOTExtRecverPoolPrefill(struct HonestOTExtRecver* r,size_t n);
+size_t honestOTExtSenderPoolDepth(struct HonestOTExtSender* s);
+size_t honestOTExtRecverPoolDepth(struct HonestOTExtRecver* r);
+
+// Semi-honest silent OT (Ferret): after a bootstrap from the honest
+//   extension, OTs cost a bit and the messages, plus refills of 0.05 to 0.7
+//   bytes each, depending on batch size. The COT versions send only opt1,
+//   opt0 being random pads chosen by the OT, and must be paired up.
+struct SilentOTSender* silentOTSenderNew(ProtocolDesc* pd,int destParty);
+void silentOTSenderRelease(struct SilentOTSender* s);
+void silentOTSend1Of2(struct SilentOTSender* s,
+    const char* opt0,const char* opt1,int n,int len);
+void silentCorrelatedOTSend1Of2(struct SilentOTSender* s,
+    char* opt0,char* opt1,int n,int len,OcOtCorrelator f,void* corrArg);
+OTsender silentOTSenderAbstract(struct SilentOTSender* s);
+COTsender silentCOTSenderAbstract(struct SilentOTSender* s);
+struct SilentOTRecver* silentOTRecverNew(ProtocolDesc* pd,int srcParty);
+void silentOTRecverRelease(struct SilentOTRecver* r);
+void silentOTRecv1Of2(struct SilentOTRecver* r,char* dest,const bool* sel,
+    int n,int len);
+void silentCorrelatedOTRecv1Of2(struct SilentOTRecver* r,char* dest,
+    const bool* sel,int n,int len);
+OTrecver silentOTRecverAbstract(struct SilentOTRecver* r);
+COTrecver silentCOTRecverAbstract(struct SilentOTRecver* r);
 
 struct OTExtSender;
 struct OTExtRecver;
@@ -117,6 +146,7 @@ OTsender maliciousOTExtSenderAbstract(struct OTExtSender* s);
 
 // Overrides ypd so that we are not using semi-honest OT
 void yaoUseFullOTExt(ProtocolDesc* pd,int me);
+void yaoUseSilentOT(ProtocolDesc* pd,int me); // still semi-honest
 void yaoUseNpot(ProtocolDesc* pd,int me);
 void yaoReleaseOt(ProtocolDesc* pd,int me); // Used with yaoUseNpot
 
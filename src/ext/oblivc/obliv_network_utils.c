@@ -12,8 +12,6 @@ typedef struct
   YaoProtocolDesc* ypd; // need the fixed key cipher for crypto test
 } NetStressProtocolDesc;
 
-#define OC_PD_TYPE_NSP 2
-
 
 static void netStressFeedOblivBool(ProtocolDesc* pd,
     OblivBit* dest, int party, bool value)
@@ -125,11 +123,15 @@ void execNetworkStressProtocol(ProtocolDesc* pd, int bytecount,
   pd->extra = nspd;
   pd->feedOblivInputs = netStressFeedOblivInputs;
   pd->revealOblivBits = netStressRevealOblivBits;
+  pd->revealOblivBitsN = NULL;
   pd->setBitAnd = netStressSetBitAnd;
   pd->setBitOr  = netStressSetBitOr;
   pd->setBitXor = netStressSetBitXor;
   pd->setBitNot = netStressSetBitNot;
   pd->flipBit   = netStressFlipBit;
+  pd->setBitsAndN = NULL;
+  pd->setBitsOrN  = NULL;
+  pd->muxN        = NULL;
   pd->partyCount= 2;
   ocSetCurrentProto(pd);
   gcryDefaultLibInit();
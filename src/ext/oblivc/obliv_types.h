@@ -56,12 +56,24 @@ struct ProtocolDesc {
   void (*feedOblivInputs)(ProtocolDesc*,OblivInputs*,size_t,int);
   // Return value is true if the write was actually done
   bool (*revealOblivBits)(ProtocolDesc*,widest_t*,const OblivBit*,size_t,int);
+  // Optional: same as above, but for any n. Output is packed little-endian
+  //   bits in char[(n+7)/8]. If NULL, revealOblivBits is used in chunks.
+  bool (*revealOblivBitsN)(ProtocolDesc*,char*,const OblivBit*,size_t,int);
 
   void (*setBitAnd)(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*);
   void (*setBitOr )(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*);
   void (*setBitXor)(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*);
   void (*setBitNot)(ProtocolDesc*,OblivBit*,const OblivBit*);
   void (*flipBit  )(ProtocolDesc*,OblivBit*); // Sometimes avoids a struct copy
+  // Optional bulk forms, NULL if the protocol only works bit by bit.
+  //   setBitsAndN/OrN only get unknown bits. r[i] may alias a[i] or b[i].
+  //   muxN sets r[i] = (c?t[i]:f[i]) for an unknown c and any t, f.
+  void (*setBitsAndN)(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*
+                     ,size_t);
+  void (*setBitsOrN )(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*
+                     ,size_t);
+  void (*muxN)(ProtocolDesc*,OblivBit*,const OblivBit*,const OblivBit*,size_t
+              ,const OblivBit*);
 
   void* extra;  // protocol-specific information
                 // First field should be char protoType
@@ -120,12 +132,21 @@ typedef struct YaoProtocolDesc {
   union { OTsender sender; OTrecver recver; };
   gcry_cipher_hd_t fixedKeyCipher;
   bool halfgates;
+  uint64_t thRandPool; int thRandBits; // random bits for three-halves gates
   proxy_MITCCRH proxy_mitccrh;
+  proxy_AESCTR label_prg; // keyed with I, for yaoKeyNewLabels
   block start_point;
   void* extra;
 } YaoProtocolDesc;
 
-#define OC_PD_TYPE_YAO 1
+// protoType ids, for the extra structs of ProtocolDesc (OC_PD_) and of
+//   YaoProtocolDesc (OC_YPD_). All of them live here, numbered as one list,
+//   so a new protocol cannot reuse an id by accident.
+#define OC_PD_TYPE_YAO          1
+#define OC_PD_TYPE_NSP          2 // obliv_network_utils.c
+#define OC_YPD_TYPE_NP          3 // privacy-free.c
+#define OC_YPD_TYPE_PREGARBLED  4 // obliv_bits.c
+#define OC_PD_TYPE_TRACE        5 // trace.c
 static inline OC_DYN_EXTRA_FUN(protoYaoProtocolDesc,ProtocolDesc,
                                YaoProtocolDesc,OC_PD_TYPE_YAO)
 typedef struct ProtocolTransport ProtocolTransport;
@@ -141,6 +162,37 @@ struct ProtocolTransport {
   void (*cleanup)(ProtocolTransport*);
 };
 
+// Options for protocolConnectTLS2PEx/protocolAcceptTLS2PEx. Zero-initialize
+//   and set only what you need.
+//   async_send: SSL_write (encryption and socket writes) runs on a dedicated
+//     thread, double-buffered, so the protocol thread can keep garbling.
+//   ktls: after the handshake, hand the traffic keys to the kernel (Linux
+//     tls ULP) and send plaintext straight to the socket. Falls back silently
+//     to OpenSSL's record layer if the kernel or OpenSSL lacks support;
+//     tls2PUsesKtls() tells which one is in use.
+//   ciphersuites: OpenSSL TLS 1.3 suite list, NULL for TLS_AES_128_GCM_SHA256.
+//     Both parties must use the same list, since the first entry is the one
+//     bound to the pre-shared key. Semi-honest protocols only need integrity
+//     of the transcript, so an authentication-only suite ("TLS_SHA256_SHA256",
+//     OpenSSL 3.4+) can be used to skip encrypting the garbled tables.
+//     Connecting fails if the local OpenSSL does not know the suite.
+//   mux_splits: split() opens a new logical stream inside this connection,
+//     instead of a new TCP + TLS connection. Both parties must agree.
+//   recv_buffer_size: if nonzero, reads are served from a read-ahead buffer
+//     of this size, so that many small orecv calls (e.g. 16 bytes per
+//     half-gate) do not each turn into an SSL_read. 16384, one TLS record,
+//     is a good choice.
+//   Split connections inherit these settings.
+typedef struct {
+  bool isProfiled;
+  size_t buffer_size;
+  bool async_send;
+  bool ktls;
+  const char* ciphersuites;
+  bool mux_splits;
+  size_t recv_buffer_size;
+} TLS2POptions;
+
 struct OblivInputs {
   union {
     unsigned long long src;
@@ -1,10 +1,18 @@
 #pragma once
 #include<obliv_types.h>
 
-typedef struct OblivBit {
-  bool unknown; // Will be default initialized with memset(0), 
-                //   so this field is 'unknown' rather than 'known'
-                //   so that the default 0 means 'known'
+// With -DOBLIV_ALIGNED_BITS (library and programs alike), every Yao label
+//   starts on a 16-byte boundary and gate code loads it with one aligned SSE
+//   move. That pads OblivBit from 18 to 32 bytes, so it is off by default. A
+//   label has no spare bits to hold the flags below: its lsb is the
+//   point-and-permute bit and the rest must stay random.
+#ifdef OBLIV_ALIGNED_BITS
+#define OBLIV_BIT_ALIGN __attribute__((aligned(16)))
+#else
+#define OBLIV_BIT_ALIGN
+#endif
+
+typedef struct OBLIV_BIT_ALIGN OblivBit {
   union {
     // a struct for each protocol we support goes here
     bool knownValue;
@@ -12,13 +20,14 @@ typedef struct OblivBit {
       // FIXME Couldn't generator just XOR R with this on a NOT?
       // generator: w is label for 0 value if inverted == false, 1 otherwise
       // evaluator: w is current label
-      yao_key_t w;
+      yao_key_t w; // first, so that it shares the struct's alignment
       union {
         bool value;    // used only by the prover in np protocol
         bool inverted; // inverted: generator use only
       };
       // npSetBitXor, npFlipBit uses assumes the two bools to be aliased
     } yao;
+    char trace[8]; // execTraceProtocol literal, bytes so as not to pad OblivBit
 #ifdef ENABLE_NNOB
 	struct {
 		NnobKey key;
@@ -26,6 +35,9 @@ typedef struct OblivBit {
 	} nnob;
 #endif
   };
+  bool unknown; // Will be default initialized with memset(0), 
+                //   so this field is 'unknown' rather than 'known'
+                //   so that the default 0 means 'known'
 } OblivBit;
 
 // Dev warning: name clashes likely. Fix when it becomes a problem
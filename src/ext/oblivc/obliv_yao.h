@@ -4,18 +4,46 @@
 // These are yao-related functions from obliv_bits.c that later became useful 
 // in other files as well
 void yaoKeyNewPair(YaoProtocolDesc* pd,yao_key_t w0,yao_key_t w1);
+void yaoKeyNewLabels(YaoProtocolDesc* pd,block* w0,size_t n);
 static inline void yaoKeyCopy(yao_key_t d, const yao_key_t s) 
   { memcpy(d,s,YAO_KEY_BYTES); }
 static inline void yaoKeyZero(yao_key_t d) { memset(d,0,YAO_KEY_BYTES); }
 static inline bool yaoKeyLsb(const yao_key_t k) { return k[0]&1; }
 static inline void yaoKeyXor(yao_key_t d, const yao_key_t s)
   { memxor(d,s,YAO_KEY_BYTES); }
+static inline block yaoKeyToBlock(const yao_key_t k)
+  { block x; memcpy(&x,k,sizeof(x)); return x; }
+// Label of b as an SSE block, and back
+static inline block yaoBitLoad(const OblivBit* b)
+#ifdef OBLIV_ALIGNED_BITS
+  { return *(const block*)b->yao.w; }
+#else
+  { block x; memcpy(&x,b->yao.w,sizeof(x)); return x; }
+#endif
+static inline void yaoBitStore(OblivBit* b,block x)
+#ifdef OBLIV_ALIGNED_BITS
+  { *(block*)b->yao.w = x; }
+#else
+  { memcpy(b->yao.w,&x,sizeof(x)); }
+#endif
 void yaoSetHalfMask(YaoProtocolDesc* ypd,
                     yao_key_t d,const yao_key_t a,uint64_t k);
 void yaoSetHashMask(YaoProtocolDesc* ypd,
                     yao_key_t d,const yao_key_t a,const yao_key_t b,
                     uint64_t k,int i);
 
+// n independent half-gate ANDs with one send, see obliv_bits.c
+void yaoGenerateHalfGatePairs(ProtocolDesc* pd, OblivBit* r,
+    bool ac, bool bc, bool rc, const OblivBit* a, const OblivBit* b, size_t n);
+void yaoEvaluateHalfGatePairs(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b, size_t n);
+void yaoGenerateAndPairs(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b, size_t n);
+void yaoGenerateOrPairs(ProtocolDesc* pd, OblivBit* r,
+    const OblivBit* a, const OblivBit* b, size_t n);
+void yaoMuxN(ProtocolDesc* pd, OblivBit* r, const OblivBit* t,
+    const OblivBit* f, size_t n, const OblivBit* c);
+
 // Assumes b is unknown
 const char* yaoKeyOfBit(const OblivBit* b);
 
@@ -27,6 +55,10 @@ extern bool yaoGenrRevealOblivBits(ProtocolDesc* pd,
                 widest_t* dest,const OblivBit* o,size_t n,int party);
 extern bool yaoEvalRevealOblivBits(ProtocolDesc* pd,
                 widest_t* dest,const OblivBit* o,size_t n,int party);
+extern bool yaoGenrRevealOblivBitsN(ProtocolDesc* pd,
+                char* dest,const OblivBit* o,size_t n,int party);
+extern bool yaoEvalRevealOblivBitsN(ProtocolDesc* pd,
+                char* dest,const OblivBit* o,size_t n,int party);
 extern void yaoGenrFeedOblivInputs(ProtocolDesc* pd
                ,OblivInputs* oi,size_t n,int src);
 extern void yaoEvalFeedOblivInputs(ProtocolDesc* pd
@@ -45,6 +77,6 @@ extern void yaoEHalfSwapGate(ProtocolDesc* pd,
 // a special "fatBit" OblivBit object. These can only be used by
 // __obliv_c__fatDecode() later. Useful with yaoHalfSwapGate.
 static inline OblivBit __obliv_c__fatBit(bool x)
-  { return (OblivBit){.unknown=false,{.knownValue=x}}; }
+  { return (OblivBit){.unknown=false,.knownValue=x}; }
 static inline bool __obliv_c__fatDecode(const OblivBit* b) 
   { return b->knownValue; }
@@ -14,6 +14,8 @@
 #include<obliv_common.h>
 #include<obliv_types.h>
 #include<commitReveal.h>
+#include<block.h>
+#include<mitccrh.h>
 #define HERE printf("%s:%d\n",__FILE__,__LINE__)
 
 inline void printhex(const char* msg,const char* buf,size_t n)
@@ -1034,6 +1036,19 @@ bcipherCryptNoResize(BCipherRandomGen* gen,const char* key,int nonce,
   randomizeBuffer(gen,dest,n);
   memxor(dest,src,n);
 }
+
+/* Messages up to one AES block with keys up to 128 bits skip the rekeying
+   above: pads are H(key,nonce) for the fixed-key hash TCCRH (mitccrh.c), in
+   batches of OT_HASH_BATCH OTs. Both sides must pick the same path, which
+   they do since it only depends on k and len. */
+#define OT_HASH_BYTES 16
+#define OT_HASH_BATCH 8
+static proxy_TCCRH otPadHash;
+static pthread_once_t otPadHashDone = PTHREAD_ONCE_INIT;
+static void otPadHashInit(void) { TCCRH_init(&otPadHash); }
+
+static bool otPadHashable(int k,int len)
+  { return k<=8*OT_HASH_BYTES && len<=OT_HASH_BYTES; }
 /*
    Actually use our extension box (possibly after validation, depending on
    how much we trust our receiver). Sends out encryptions of msg0 and msg1
@@ -1047,6 +1062,40 @@ bcipherCryptNoResize(BCipherRandomGen* gen,const char* key,int nonce,
    encryption (we apply resetBCipherRandomGen, so it will lose any existing
    state). It is just so we don't have to allocate a new cipher every time.
    */
+/* Column-major cache of the extension box. Key for OT column c is the k
+   bits box[rows[j]][c], which used to be gathered with k getBit() calls per
+   OT. Instead we copy an OT_TRANS_COLS wide strip of the selected rows and
+   transpose it in one go with sse_trans, so keys[(c-from)*k/8 ..] is then
+   the packed key for each column in [from,to).
+   */
+#define OT_TRANS_COLS 128
+typedef struct { char *strip, *keys; int from, to; } BoxColumns;
+
+static void boxColumnsInit(BoxColumns* bc,int k)
+{ bc->strip = malloc(k*OT_TRANS_COLS/8);
+  bc->keys = malloc(k*OT_TRANS_COLS/8);
+  bc->from = bc->to = 0;
+}
+static void boxColumnsRelease(BoxColumns* bc)
+  { free(bc->strip); free(bc->keys); }
+
+static const char* boxColumn(BoxColumns* bc,const char* box,const int* rows,
+                             int k,int rowBytes,int c)
+{
+  if(c<bc->from || c>=bc->to)
+  { const int sb = OT_TRANS_COLS/8, b = c/8;
+    const int nb = (rowBytes-b<sb?rowBytes-b:sb);
+    int i;
+    for(i=0;i<k;++i)
+    { memcpy(bc->strip+i*sb,box+rows[i]*rowBytes+b,nb);
+      memset(bc->strip+i*sb+nb,0,sb-nb);
+    }
+    sse_trans((uint8_t*)bc->keys,(const uint8_t*)bc->strip,k,OT_TRANS_COLS);
+    bc->from = 8*b; bc->to = bc->from+OT_TRANS_COLS;
+  }
+  return bc->keys+(c-bc->from)*(k/8);
+}
+
 typedef struct
 { BCipherRandomGen *cipher;
   const char *box;
@@ -1055,6 +1104,9 @@ typedef struct
   const char *spack;
   ProtocolTransport *trans;
   char *buf; int bufused;
+  BoxColumns cols;
+  struct OTWorkerPool* pool;
+  bool randomOnly; // Just output both pads, nothing is sent
   OcOtCorrelator corrFun; // Callback function
   void* corrArg;
   void* sender;
@@ -1083,18 +1135,11 @@ static void sendBufRelease(SendMsgArgs* a) { sendBufFlush(a); free(a->buf); }
 void
 senderExtensionBoxSendMsg(SendMsgArgs* a)
 {
-  int i;
   char keyx[a->cipher->klen], *ctext = malloc(a->len);
   assert(a->k%8==0 && a->k/8<=sizeof keyx);
   memset(keyx+a->k/8,0,sizeof keyx-a->k/8);
-  //for(i=0;i<k;++i) setBit(keyx,i,getBit(box+rows[i]*rowBytes,c));
-  for(i=0;i<a->k/8;i++)
-  {
-    int j=0; char ch=0;
-    for(j=7;j>=0;--j)
-      ch = ((ch<<1)|getBit(a->box+a->rows[8*i+j]*a->rowBytes,a->c));
-    keyx[i]=ch;
-  }
+  memcpy(keyx,boxColumn(&a->cols,a->box,a->rows,a->k,a->rowBytes,a->c),
+         a->k/8);
   if(a->corrFun)                            // If we are doing correlated OTs
   { memset(ctext,0,a->len);                 // Decrypt zeroes
     bcipherCryptNoResize(a->cipher,keyx,a->nonce,a->opt0,ctext,a->len);
@@ -1112,6 +1157,40 @@ senderExtensionBoxSendMsg(SendMsgArgs* a)
   a->nonce+=a->nonceDelta;
   free(ctext);
 }
+static void
+senderExtensionBoxSendHashed(SendMsgArgs* a,int m)
+{
+  block in[2*OT_HASH_BATCH], pad[2*OT_HASH_BATCH], s = {0};
+  uint64_t tweak[2*OT_HASH_BATCH];
+  int i;
+  memcpy(&s,a->spack,a->k/8);
+  for(i=0;i<m;++i)
+  { in[2*i] = (block){0};
+    memcpy(in+2*i,boxColumn(&a->cols,a->box,a->rows,a->k,a->rowBytes,a->c+i),
+           a->k/8);
+    in[2*i+1] = in[2*i]^s;
+    tweak[2*i] = tweak[2*i+1] = a->nonce+i*a->nonceDelta;
+  }
+  TCCRH_hash_n(&otPadHash,in,tweak,pad,2*m);
+  for(i=0;i<m;++i)
+  { if(a->randomOnly)
+    { memcpy(a->opt0,pad+2*i,a->len);
+      memcpy(a->opt1,pad+2*i+1,a->len);
+    }else if(a->corrFun)
+    { memcpy(a->opt0,pad+2*i,a->len);
+      a->corrFun(a->opt1,a->opt0,a->c,a->corrArg);
+    }else
+    { memxor((char*)(pad+2*i),a->opt0,a->len);
+      sendBufSend(a,(char*)(pad+2*i));
+    }
+    if(!a->randomOnly)
+    { memxor((char*)(pad+2*i+1),a->opt1,a->len);
+      sendBufSend(a,(char*)(pad+2*i+1));
+    }
+    a->opt0+=a->len; a->opt1+=a->len; a->c++;
+    a->nonce+=a->nonceDelta;
+  }
+}
 // mask should be the same as the one previously used to construct box[]
 // All other parameters (c,nonce,box,rowBytes etc.) should match the ones the
 // sender is expected to use.
@@ -1123,6 +1202,9 @@ typedef struct
   const char *mask; // Receiver's selections
   ProtocolTransport *trans;
   char *buf; int bufread, payloadLeft;
+  BoxColumns cols;
+  struct OTWorkerPool* pool;
+  bool randomOnly; // Just output the pad, nothing is received
   bool isCorr;
   void* recver;
 } RecvMsgArgs;
@@ -1151,19 +1233,12 @@ static void recvBufRelease(RecvMsgArgs* a) { free(a->buf); }
 void
 recverExtensionBoxRecvMsg(RecvMsgArgs* a)
 {
-  int i;
   bool sel = getBit(a->mask,a->c);
   char keyx[a->cipher->klen], *ctext = malloc(a->len);
   assert(a->k%8==0 && a->k/8<=sizeof keyx);
   memset(keyx+a->k/8,0,sizeof keyx-a->k/8);
-  //for(i=0;i<k;++i) setBit(keyx,i,getBit(box+rows[i]*rowBytes,c));
-  for(i=0;i<a->k/8;i++)
-  {
-    int j=0; char ch=0;
-    for(j=7;j>=0;--j)
-      ch = ((ch<<1)|getBit(a->box+a->rows[8*i+j]*a->rowBytes,a->c));
-    keyx[i]=ch;
-  }
+  memcpy(keyx,boxColumn(&a->cols,a->box,a->rows,a->k,a->rowBytes,a->c),
+         a->k/8);
   // For correlated OTs, just imagine you are receiving zeroes
   if(a->isCorr) memset(sel?a->msg:ctext,0,a->len);
   else recvBufRecv(a,sel?a->msg:ctext);
@@ -1173,27 +1248,168 @@ recverExtensionBoxRecvMsg(RecvMsgArgs* a)
   free(ctext);
 }
 
+static void
+recverExtensionBoxRecvHashed(RecvMsgArgs* a,int m)
+{
+  block in[OT_HASH_BATCH], pad[OT_HASH_BATCH];
+  uint64_t tweak[OT_HASH_BATCH];
+  char ctext[OT_HASH_BYTES];
+  int i;
+  for(i=0;i<m;++i)
+  { in[i] = (block){0};
+    memcpy(in+i,boxColumn(&a->cols,a->box,a->rows,a->k,a->rowBytes,a->c+i),
+           a->k/8);
+    tweak[i] = a->nonce+i*a->nonceDelta;
+  }
+  TCCRH_hash_n(&otPadHash,in,tweak,pad,m);
+  for(i=0;i<m;++i)
+  { bool sel = getBit(a->mask,a->c);
+    if(a->randomOnly) memcpy(a->msg,pad+i,a->len);
+    else
+    { if(a->isCorr) memset(sel?a->msg:ctext,0,a->len);
+      else recvBufRecv(a,sel?a->msg:ctext);
+      recvBufRecv(a,sel?ctext:a->msg);
+      memcpy(a->msg,pad+i,a->len);
+      memxor(a->msg,ctext,a->len);
+    }
+    a->msg+=a->len; a->c++;
+    a->nonce+=a->nonceDelta;
+  }
+}
+
+/* Worker threads for large batches, kept for the life of an OT extension
+   sender or receiver. Each has its own split transport and cipher, so that
+   new connections (and TLS handshakes) are not set up on every call. The
+   pool starts on the first large batch, a point both parties reach on the
+   same call: they swap their otThreadCount and use the smaller one.
+   */
+static int otThreadCount = OT_THREAD_COUNT;
+void setOTThreadCount(int n) { otThreadCount = n; }
+
+typedef struct OTWorkerPool OTWorkerPool;
+typedef struct
+{ pthread_t th;
+  ProtocolTransport *trans;
+  BCipherRandomGen *cipher;
+  void* (*job)(void*); void* jobArg;
+  OTWorkerPool *pool;
+} OTWorker;
+struct OTWorkerPool
+{ int count; // -1 until started, 0 if we ended up without workers
+  OTWorker *w;
+  unsigned round; int pending; bool stop;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+static void otPoolInit(OTWorkerPool* p)
+{ p->count = -1; p->w = NULL;
+  p->round = 0; p->pending = 0; p->stop = false;
+  pthread_mutex_init(&p->lock,NULL);
+  pthread_cond_init(&p->cond,NULL);
+}
+static void* otWorkerThread(void* va)
+{ OTWorker* w=va;
+  OTWorkerPool* p=w->pool;
+  unsigned seen=0;
+  pthread_mutex_lock(&p->lock);
+  while(true)
+  { while(!p->stop && p->round==seen) pthread_cond_wait(&p->cond,&p->lock);
+    if(p->stop) break;
+    seen=p->round;
+    pthread_mutex_unlock(&p->lock);
+    w->job(w->jobArg);
+    transFlush(w->trans);
+    pthread_mutex_lock(&p->lock);
+    if(--p->pending==0) pthread_cond_broadcast(&p->cond);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+static void otPoolStart(OTWorkerPool* p,ProtocolTransport* trans,int peer,
+                        BCipherRandomGen* cipher)
+{
+  int mine=otThreadCount, theirs, i;
+  transSend(trans,peer,&mine,sizeof(mine));
+  transFlush(trans);
+  transRecv(trans,peer,&theirs,sizeof(theirs));
+  p->count = (theirs<mine?theirs:mine);
+  if(p->count<=1) { p->count=0; return; }
+  p->w = malloc(sizeof(OTWorker[p->count]));
+  for(i=0;i<p->count;++i)
+  { OTWorker* w = p->w+i;
+    w->pool = p;
+    w->trans = trans->split(trans);
+    w->cipher = copyBCipherRandomGenNoKey(cipher);
+    pthread_create(&w->th,NULL,otWorkerThread,w);
+  }
+}
+// Runs w[i].job(w[i].jobArg) on every worker, and waits for all of them
+static void otPoolRun(OTWorkerPool* p)
+{
+  pthread_mutex_lock(&p->lock);
+  p->pending=p->count;
+  p->round++;
+  pthread_cond_broadcast(&p->cond);
+  while(p->pending>0) pthread_cond_wait(&p->cond,&p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
+static void otPoolCleanup(OTWorkerPool* p)
+{
+  int i;
+  pthread_mutex_lock(&p->lock);
+  p->stop=true;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  for(i=0;i<p->count;++i)
+  { pthread_join(p->w[i].th,NULL);
+    p->w[i].trans->cleanup(p->w[i].trans);
+    releaseBCipherRandomGen(p->w[i].cipher);
+  }
+  free(p->w);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+}
+// Whether this batch goes to the pool, starting it if needed. If so, we
+//   flush trans since the peer may be waiting on it (a split used to do that)
+static bool otPoolUse(OTWorkerPool* p,ProtocolTransport* trans,int peer,
+                      BCipherRandomGen* cipher,int n)
+{
+  if(!transCanThread(trans) || n<=OT_THREAD_THRESHOLD) return false;
+  if(p->count<0) otPoolStart(p,trans,peer,cipher);
+  if(p->count==0) return false;
+  transFlush(trans);
+  return true;
+}
+
 static void* senderExtensionBoxSendMsgs_thread(void* va)
 { SendMsgArgs* a=va;
   int i;
   sendBufInit(a);
-  for(i=0;i<a->n;++i)
+  boxColumnsInit(&a->cols,a->k);
+  if(otPadHashable(a->k,a->len))
+  { pthread_once(&otPadHashDone,otPadHashInit);
+    for(i=0;i<a->n;i+=OT_HASH_BATCH)
+      senderExtensionBoxSendHashed(a,
+          a->n-i<OT_HASH_BATCH?a->n-i:OT_HASH_BATCH);
+  }
+  else for(i=0;i<a->n;++i)
   { senderExtensionBoxSendMsg(a);
     a->opt0+=a->len; a->opt1+=a->len; a->c++;
   }
+  boxColumnsRelease(&a->cols);
   sendBufRelease(a);
   return NULL;
 }
 void
 senderExtensionBoxSendMsgs(SendMsgArgs* a)
 {
-  if(!transCanThread(a->trans) || a->n<=OT_THREAD_THRESHOLD)
+  OTWorkerPool* p = a->pool;
+  if(!otPoolUse(p,a->trans,a->destParty,a->cipher,a->n))
     senderExtensionBoxSendMsgs_thread(a);
-
   else
-  { pthread_t th[OT_THREAD_COUNT];
-    SendMsgArgs si[OT_THREAD_COUNT];
-    int i,ndone=0,tc=OT_THREAD_COUNT;
+  { SendMsgArgs si[p->count];
+    int i,ndone=0,tc=p->count;
     for(i=0;i<tc;++i)
     { si[i]=*a;
       si[i].c=ndone;
@@ -1201,17 +1417,14 @@ senderExtensionBoxSendMsgs(SendMsgArgs* a)
       si[i].nonce=a->nonce+ndone*a->nonceDelta;
       si[i].opt0=a->opt0+a->len*ndone;
       si[i].opt1=a->opt1+a->len*ndone;
-      si[i].trans=a->trans->split(a->trans);
-      si[i].cipher=copyBCipherRandomGenNoKey(a->cipher);
-      pthread_create(&th[i],NULL,senderExtensionBoxSendMsgs_thread,&si[i]);
+      si[i].trans=p->w[i].trans;
+      si[i].cipher=p->w[i].cipher;
+      p->w[i].job=senderExtensionBoxSendMsgs_thread;
+      p->w[i].jobArg=&si[i];
       ndone+=si[i].n;
     }
     assert(ndone==a->n);
-    for(i=0;i<tc;++i)
-    { pthread_join(th[i],NULL);
-      si[i].trans->cleanup(si[i].trans);
-      releaseBCipherRandomGen(si[i].cipher);
-    }
+    otPoolRun(p);
     a->nonce+=ndone*a->nonceDelta;
   }
 }
@@ -1220,40 +1433,44 @@ static void* recverExtensionBoxRecvMsgs_thread(void* va)
 { RecvMsgArgs* a=va;
   int i;
   recvBufInit(a);
-  for(i=0;i<a->n;++i)
+  boxColumnsInit(&a->cols,a->k);
+  if(otPadHashable(a->k,a->len))
+  { pthread_once(&otPadHashDone,otPadHashInit);
+    for(i=0;i<a->n;i+=OT_HASH_BATCH)
+      recverExtensionBoxRecvHashed(a,
+          a->n-i<OT_HASH_BATCH?a->n-i:OT_HASH_BATCH);
+  }
+  else for(i=0;i<a->n;++i)
   { recverExtensionBoxRecvMsg(a);
     a->msg+=a->len; a->c++;
   }
+  boxColumnsRelease(&a->cols);
   recvBufRelease(a);
   return NULL;
 }
 void
 recverExtensionBoxRecvMsgs(RecvMsgArgs* a)
 {
-  if(!transCanThread(a->trans) || a->n<=OT_THREAD_THRESHOLD)
+  OTWorkerPool* p = a->pool;
+  if(!otPoolUse(p,a->trans,a->srcParty,a->cipher,a->n))
     recverExtensionBoxRecvMsgs_thread(a);
   else
-  {
-    pthread_t th[OT_THREAD_COUNT];
-    RecvMsgArgs ri[OT_THREAD_COUNT];
-    int i,ndone=0,tc=OT_THREAD_COUNT;
+  { RecvMsgArgs ri[p->count];
+    int i,ndone=0,tc=p->count;
     for(i=0;i<tc;++i)
     { ri[i]=*a;
       ri[i].c=ndone;
       ri[i].n=(a->n-ndone+tc-i-1)/(tc-i);
       ri[i].nonce=a->nonce+ndone*a->nonceDelta;
       ri[i].msg=a->msg+a->len*ndone;
-      ri[i].trans=a->trans->split(a->trans);
-      ri[i].cipher=copyBCipherRandomGenNoKey(a->cipher);
-      pthread_create(&th[i],NULL,recverExtensionBoxRecvMsgs_thread,&ri[i]);
+      ri[i].trans=p->w[i].trans;
+      ri[i].cipher=p->w[i].cipher;
+      p->w[i].job=recverExtensionBoxRecvMsgs_thread;
+      p->w[i].jobArg=&ri[i];
       ndone+=ri[i].n;
     }
     assert(ndone==a->n);
-    for(i=0;i<tc;++i)
-    { pthread_join(th[i],NULL);
-      ri[i].trans->cleanup(ri[i].trans);
-      releaseBCipherRandomGen(ri[i].cipher);
-    }
+    otPoolRun(p);
     a->nonce+=ndone*a->nonceDelta;
   }
 }
@@ -1267,23 +1484,30 @@ typedef struct HonestOTExtSender
 { SenderExtensionBox* box;
   BCipherRandomGen* padder;
   size_t nonce;
+  OTWorkerPool pool;
+  struct OTRandomPool* rpool; // NULL unless honestOTExtSenderPoolStart
 } HonestOTExtSender;
 
 typedef struct HonestOTExtRecver
 { RecverExtensionBox* box;
   BCipherRandomGen* padder;
   size_t nonce;
+  OTWorkerPool pool;
+  struct OTRandomPool* rpool;
 } HonestOTExtRecver;
 
 #define OT_KEY_BYTES_HONEST 10
 #define OT_KEY_BYTES_MAL_HHASH 20
 #define OT_KEY_BYTES_MAL_BYPAIR 38
+static void otRandomPoolRelease(struct OTRandomPool* p);
 void
 honestOTExtSenderInit(HonestOTExtSender* s,ProtocolDesc* pd,
                       int destParty,int keyBytes)
 { s->box = senderExtensionBoxNew(pd,destParty,keyBytes);
   s->padder = newBCipherRandomGen();
   s->nonce = 0;
+  otPoolInit(&s->pool);
+  s->rpool = NULL;
 }
 HonestOTExtSender*
 honestOTExtSenderNew(ProtocolDesc* pd,int destParty)
@@ -1297,6 +1521,8 @@ honestOTExtRecverInit(HonestOTExtRecver* r,ProtocolDesc* pd,
 { r->box = recverExtensionBoxNew(pd,srcParty,keyBytes);
   r->padder = newBCipherRandomGen();
   r->nonce = 0;
+  otPoolInit(&r->pool);
+  r->rpool = NULL;
 }
 HonestOTExtRecver*
 honestOTExtRecverNew(ProtocolDesc* pd,int srcParty)
@@ -1306,7 +1532,9 @@ honestOTExtRecverNew(ProtocolDesc* pd,int srcParty)
 }
 void
 honestOTExtSenderCleanup(HonestOTExtSender* s)
-{ senderExtensionBoxRelease(s->box);
+{ if(s->rpool) otRandomPoolRelease(s->rpool);
+  otPoolCleanup(&s->pool);
+  senderExtensionBoxRelease(s->box);
   releaseBCipherRandomGen(s->padder);
 }
 void
@@ -1316,7 +1544,9 @@ honestOTExtSenderRelease(HonestOTExtSender* s)
 }
 void
 honestOTExtRecverCleanup(HonestOTExtRecver* r)
-{ recverExtensionBoxRelease(r->box);
+{ if(r->rpool) otRandomPoolRelease(r->rpool);
+  otPoolCleanup(&r->pool);
+  recverExtensionBoxRelease(r->box);
   releaseBCipherRandomGen(r->padder);
 }
 void
@@ -1325,6 +1555,287 @@ honestOTExtRecverRelease(HonestOTExtRecver* r)
   free(r);
 }
 
+/* Random OT pool. A thread on its own split connection, with its own base
+   OTs, runs the extension ahead of time with no messages: the sender keeps
+   both pads, the receiver a random choice c and pad r_c. Send1Of2/Recv1Of2
+   then derandomize (Beaver): the receiver sends d = sel^c, the sender
+   opt0^r_d and opt1^r_(1-d). That is one bit and two messages per OT, with
+   no crypto on the critical path. The sender's thread decides when to
+   produce (staying depth ahead, or as far as a prefill or a waiting
+   Send1Of2 needs), and tells the receiver's thread on the channel.
+   */
+#define OT_POOL_CHUNK (1<<15)
+typedef struct OTRandomPool
+{ bool isSender;
+  int peer;
+  ProtocolDesc *main, pd; // pd is just the split channel
+  HonestOTExtSender s; // only one of these is used
+  HonestOTExtRecver r;
+  BCipherRandomGen* gen; // receiver's choices
+  // Random OTs [base,produced) are at index 0.., used up to consumed
+  char *r0, *r1; // sender: both pads. receiver: r0 is r_c
+  bool *c;
+  size_t cap;
+  uint64_t base, produced, consumed, want, depth;
+  bool stop;
+  pthread_t th;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} OTRandomPool;
+
+// n random OTs, OT_HASH_BYTES per pad: just the extension and the hashing
+static void honestOTExtSendRandom(HonestOTExtSender* s,char* r0,char* r1,int n)
+{
+  const int k = 8*s->box->keyBytes, rowBytes = (n+7)/8;
+  char *box = malloc(k*rowBytes);
+  int i, *all = allRows(k);
+  senderExtensionBox(s->box,box,rowBytes);
+  SendMsgArgs a = {
+    .box=box, .n=n, .rowBytes=rowBytes, .rows=all, .k=k,
+    .nonce=s->nonce, .nonceDelta=1, .c=0, .opt0=r0, .opt1=r1,
+    .len=OT_HASH_BYTES, .spack=s->box->spack, .randomOnly=true
+  };
+  assert(otPadHashable(k,a.len));
+  pthread_once(&otPadHashDone,otPadHashInit);
+  boxColumnsInit(&a.cols,k);
+  for(i=0;i<n;i+=OT_HASH_BATCH)
+    senderExtensionBoxSendHashed(&a,n-i<OT_HASH_BATCH?n-i:OT_HASH_BATCH);
+  boxColumnsRelease(&a.cols);
+  s->nonce=a.nonce;
+  free(all); free(box);
+}
+static void honestOTExtRecvRandom(HonestOTExtRecver* r,BCipherRandomGen* gen,
+                                  char* rc,bool* c,int n)
+{
+  const int k = 8*r->box->keyBytes, rowBytes = (n+7)/8;
+  char *box = malloc(k*rowBytes), *mask = malloc(rowBytes);
+  int i, *all = allRows(k);
+  randomizeBuffer(gen,mask,rowBytes);
+  recverExtensionBox(r->box,box,mask,rowBytes);
+  RecvMsgArgs a = {
+    .box=box, .n=n, .rowBytes=rowBytes, .rows=all, .k=k,
+    .nonce=r->nonce, .nonceDelta=1, .c=0, .msg=rc, .mask=mask,
+    .len=OT_HASH_BYTES, .randomOnly=true
+  };
+  assert(otPadHashable(k,a.len));
+  pthread_once(&otPadHashDone,otPadHashInit);
+  boxColumnsInit(&a.cols,k);
+  for(i=0;i<n;i+=OT_HASH_BATCH)
+    recverExtensionBoxRecvHashed(&a,n-i<OT_HASH_BATCH?n-i:OT_HASH_BATCH);
+  boxColumnsRelease(&a.cols);
+  r->nonce=a.nonce;
+  for(i=0;i<n;++i) c[i]=getBit(mask,i);
+  free(all); free(mask); free(box);
+}
+
+// Called with p->lock held
+static void otRandomPoolAppend(OTRandomPool* p,const char* r0,const char* r1,
+                               const bool* c,int n)
+{
+  const size_t B = OT_HASH_BYTES;
+  size_t used = p->produced-p->base;
+  if(used+n>p->cap)
+  { size_t drop = p->consumed-p->base;
+    used -= drop;
+    memmove(p->r0,p->r0+drop*B,used*B);
+    if(p->isSender) memmove(p->r1,p->r1+drop*B,used*B);
+    else memmove(p->c,p->c+drop,used*sizeof(bool));
+    p->base = p->consumed;
+    if(used+n>p->cap)
+    { p->cap = (2*p->cap>used+n?2*p->cap:used+n);
+      p->r0 = realloc(p->r0,p->cap*B);
+      if(p->isSender) p->r1 = realloc(p->r1,p->cap*B);
+      else p->c = realloc(p->c,p->cap*sizeof(bool));
+    }
+  }
+  memcpy(p->r0+used*B,r0,n*B);
+  if(p->isSender) memcpy(p->r1+used*B,r1,n*B);
+  else memcpy(p->c+used,c,n*sizeof(bool));
+  p->produced += n;
+  pthread_cond_broadcast(&p->cond);
+}
+static void* otRandomPoolThread(void* va)
+{
+  OTRandomPool* p = va;
+  char *r0 = malloc(OT_POOL_CHUNK*OT_HASH_BYTES),
+       *r1 = malloc(OT_POOL_CHUNK*OT_HASH_BYTES);
+  bool *c = malloc(OT_POOL_CHUNK*sizeof(bool));
+  char more;
+  if(p->isSender)
+  { pthread_mutex_lock(&p->lock);
+    while(true)
+    { while(!p->stop && p->produced>=p->want
+                     && p->produced-p->consumed>=p->depth)
+        pthread_cond_wait(&p->cond,&p->lock);
+      if(p->stop) break;
+      pthread_mutex_unlock(&p->lock);
+      more = 1;
+      osend(&p->pd,p->peer,&more,1);
+      transFlush(p->pd.trans);
+      honestOTExtSendRandom(&p->s,r0,r1,OT_POOL_CHUNK);
+      pthread_mutex_lock(&p->lock);
+      otRandomPoolAppend(p,r0,r1,NULL,OT_POOL_CHUNK);
+    }
+    pthread_mutex_unlock(&p->lock);
+    more = 0;
+    osend(&p->pd,p->peer,&more,1);
+    transFlush(p->pd.trans);
+  }else
+    while(orecv(&p->pd,p->peer,&more,1),more)
+    { honestOTExtRecvRandom(&p->r,p->gen,r0,c,OT_POOL_CHUNK);
+      transFlush(p->pd.trans);
+      pthread_mutex_lock(&p->lock);
+      otRandomPoolAppend(p,r0,NULL,c,OT_POOL_CHUNK);
+      pthread_mutex_unlock(&p->lock);
+    }
+  free(r0); free(r1); free(c);
+  return NULL;
+}
+static OTRandomPool* otRandomPoolNew(ProtocolDesc* pd,int peer,bool isSender,
+                                     size_t depth)
+{
+  if(!protoCanThread(pd)) return NULL;
+  OTRandomPool* p = calloc(1,sizeof *p);
+  p->isSender = isSender;
+  p->peer = peer;
+  p->main = pd;
+  p->depth = depth;
+  p->pd.partyCount = 2;
+  p->pd.thisParty = pd->thisParty;
+  p->pd.trans = pd->trans->split(pd->trans);
+  if(isSender) honestOTExtSenderInit(&p->s,&p->pd,peer,OT_KEY_BYTES_HONEST);
+  else
+  { honestOTExtRecverInit(&p->r,&p->pd,peer,OT_KEY_BYTES_HONEST);
+    p->gen = newBCipherRandomGen();
+  }
+  pthread_mutex_init(&p->lock,NULL);
+  pthread_cond_init(&p->cond,NULL);
+  pthread_create(&p->th,NULL,otRandomPoolThread,p);
+  return p;
+}
+// The receiver's thread stops once the sender's does, so flush the main
+//   channel first, as in otRandomPoolTake
+static void otRandomPoolRelease(OTRandomPool* p)
+{
+  transFlush(p->main->trans);
+  pthread_mutex_lock(&p->lock);
+  p->stop = true;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->th,NULL);
+  if(p->isSender) honestOTExtSenderCleanup(&p->s);
+  else
+  { honestOTExtRecverCleanup(&p->r);
+    releaseBCipherRandomGen(p->gen);
+  }
+  p->pd.trans->cleanup(p->pd.trans);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  free(p->r0); free(p->r1); free(p->c);
+  free(p);
+}
+// Waits until n more are ready. Also used for prefill, with r0==NULL
+static void otRandomPoolTake(OTRandomPool* p,char* r0,char* r1,bool* c,
+                             size_t n)
+{
+  const size_t B = OT_HASH_BYTES;
+  pthread_mutex_lock(&p->lock);
+  if(p->want<p->consumed+n)
+  { p->want = p->consumed+n;
+    pthread_cond_broadcast(&p->cond);
+  }
+  if(p->produced<p->consumed+n)
+  { // The peer may still be waiting on our last message, and its pool thread
+    //   is what we are waiting on
+    pthread_mutex_unlock(&p->lock);
+    transFlush(p->main->trans);
+    pthread_mutex_lock(&p->lock);
+  }
+  while(p->produced<p->consumed+n) pthread_cond_wait(&p->cond,&p->lock);
+  if(r0)
+  { size_t off = p->consumed-p->base;
+    memcpy(r0,p->r0+off*B,n*B);
+    if(p->isSender) memcpy(r1,p->r1+off*B,n*B);
+    else memcpy(c,p->c+off,n*sizeof(bool));
+    p->consumed += n;
+    pthread_cond_broadcast(&p->cond); // may need topping up
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+static size_t otRandomPoolDepth(OTRandomPool* p)
+{
+  pthread_mutex_lock(&p->lock);
+  size_t rv = p->produced-p->consumed;
+  pthread_mutex_unlock(&p->lock);
+  return rv;
+}
+static void otRandomPoolSetDepth(OTRandomPool* p,size_t depth)
+{
+  pthread_mutex_lock(&p->lock);
+  p->depth = depth;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+static void
+otRandomPoolSend(OTRandomPool* p,ProtocolDesc* pd,int destParty,
+                 const char* opt0,const char* opt1,int n,int len)
+{
+  const int B = OT_HASH_BYTES;
+  char *r0 = malloc(n*B), *r1 = malloc(n*B), *e = malloc(2*n*len),
+       *d = malloc((n+7)/8);
+  int i;
+  otRandomPoolTake(p,r0,r1,NULL,n);
+  orecv(pd,destParty,d,(n+7)/8);
+  for(i=0;i<n;++i)
+  { bool di = getBit(d,i);
+    char *e0 = e+2*i*len, *e1 = e0+len;
+    memcpy(e0,opt0+i*len,len); memxor(e0,(di?r1:r0)+i*B,len);
+    memcpy(e1,opt1+i*len,len); memxor(e1,(di?r0:r1)+i*B,len);
+  }
+  osend(pd,destParty,e,2*n*len);
+  free(r0); free(r1); free(e); free(d);
+}
+static void
+otRandomPoolRecv(OTRandomPool* p,ProtocolDesc* pd,int srcParty,
+                 char* dest,const bool* sel,int n,int len)
+{
+  const int B = OT_HASH_BYTES;
+  char *r = malloc(n*B), *e = malloc(2*n*len), *d = calloc((n+7)/8,1);
+  bool *c = malloc(n*sizeof(bool));
+  int i;
+  otRandomPoolTake(p,r,NULL,c,n);
+  for(i=0;i<n;++i) setBit(d,i,sel[i]!=c[i]);
+  osend(pd,srcParty,d,(n+7)/8);
+  orecv(pd,srcParty,e,2*n*len);
+  for(i=0;i<n;++i)
+  { memcpy(dest+i*len,e+(2*i+sel[i])*len,len);
+    memxor(dest+i*len,r+i*B,len);
+  }
+  free(r); free(e); free(d); free(c);
+}
+
+bool honestOTExtSenderPoolStart(HonestOTExtSender* s,size_t depth)
+{
+  if(s->rpool) otRandomPoolSetDepth(s->rpool,depth);
+  else s->rpool = otRandomPoolNew(s->box->pd,s->box->destParty,true,depth);
+  return s->rpool!=NULL;
+}
+bool honestOTExtRecverPoolStart(HonestOTExtRecver* r,size_t depth)
+{
+  if(r->rpool) otRandomPoolSetDepth(r->rpool,depth);
+  else r->rpool = otRandomPoolNew(r->box->pd,r->box->srcParty,false,depth);
+  return r->rpool!=NULL;
+}
+void honestOTExtSenderPoolPrefill(HonestOTExtSender* s,size_t n)
+  { if(s->rpool) otRandomPoolTake(s->rpool,NULL,NULL,NULL,n); }
+void honestOTExtRecverPoolPrefill(HonestOTExtRecver* r,size_t n)
+  { if(r->rpool) otRandomPoolTake(r->rpool,NULL,NULL,NULL,n); }
+size_t honestOTExtSenderPoolDepth(HonestOTExtSender* s)
+  { return s->rpool?otRandomPoolDepth(s->rpool):0; }
+size_t honestOTExtRecverPoolDepth(HonestOTExtRecver* r)
+  { return r->rpool?otRandomPoolDepth(r->rpool):0; }
+
 void* honestOTExtSend1Of2Start(HonestOTExtSender* s,int n)
 {
   SendMsgArgs* args = malloc(sizeof(SendMsgArgs));
@@ -1339,7 +1850,7 @@ void* honestOTExtSend1Of2Start(HonestOTExtSender* s,int n)
     .k=k, .nonce=s->nonce, .nonceDelta = 0, .c=0,
     .opt0=NULL, .opt1=NULL, .len=0,
     .destParty=s->box->destParty, .spack=s->box->spack,
-    .trans=s->box->pd->trans, .corrFun=NULL, .corrArg=NULL,
+    .trans=s->box->pd->trans, .pool=&s->pool, .corrFun=NULL, .corrArg=NULL,
     .sender=s
   };
   return args;
@@ -1382,7 +1893,9 @@ honestOTExtSend1Of2_impl(
 void honestOTExtSend1Of2(HonestOTExtSender* s,const char* opt0,const char* opt1,
     int n,int len)
 {
-  honestOTExtSend1Of2_impl(s,(char*)opt0,(char*)opt1,n,len,NULL,NULL);
+  if(s->rpool && len<=OT_HASH_BYTES)
+    otRandomPoolSend(s->rpool,s->box->pd,s->box->destParty,opt0,opt1,n,len);
+  else honestOTExtSend1Of2_impl(s,(char*)opt0,(char*)opt1,n,len,NULL,NULL);
 }
 void honestCorrelatedOTExtSend1Of2(HonestOTExtSender* s,char* opt0,char* opt1,
     int n,int len,OcOtCorrelator f,void* corrArg)
@@ -1405,7 +1918,7 @@ void* honestOTExtRecv1Of2Start(HonestOTExtRecver* r,const bool* sel,int n)
     .k=k, .nonce=r->nonce, .nonceDelta = 0, .c=0,
     .msg=NULL, .mask=mask, .len=0,
     .srcParty=r->box->srcParty,
-    .trans=r->box->pd->trans, .isCorr = false,
+    .trans=r->box->pd->trans, .pool=&r->pool, .isCorr = false,
     .recver=r
   };
   return args;
@@ -1444,7 +1957,9 @@ void honestOTExtRecv1Of2_impl(HonestOTExtRecver* r,char* dest,const bool* sel,
 void honestOTExtRecv1Of2(HonestOTExtRecver* r,char* dest,const bool* sel,
     int n,int len)
 {
-  honestOTExtRecv1Of2_impl(r,dest,sel,n,len,false);
+  if(r->rpool && len<=OT_HASH_BYTES)
+    otRandomPoolRecv(r->rpool,r->box->pd,r->box->srcParty,dest,sel,n,len);
+  else honestOTExtRecv1Of2_impl(r,dest,sel,n,len,false);
 }
 void honestCorrelatedOTExtRecv1Of2(HonestOTExtRecver* r,char* dest,
     const bool* sel,int n,int len)
@@ -1570,7 +2085,8 @@ otExtSend1Of2(OTExtSender* ss,const char* opt0,const char* opt1,
       .k=rc, .nonce=s->nonce, .nonceDelta=(len+blen-1)/blen,
       .opt0=(char*)opt0, .opt1=(char*)opt1, .len=len,
       .destParty=s->box->destParty, .spack=s->box->spack,
-      .trans=s->box->pd->trans, .corrFun=NULL, .corrArg=NULL
+      .trans=s->box->pd->trans, .pool=&s->pool,
+      .corrFun=NULL, .corrArg=NULL
     };
     senderExtensionBoxSendMsgs(&args);
     s->nonce=args.nonce;
@@ -1623,7 +2139,8 @@ otExtRecv1Of2(OTExtRecver* rr,char* dest,const bool* sel,
       .cipher=r->padder, .box=box, .n=n, .rowBytes=rowBytes, .rows=rows,
       .k=rc, .nonce=r->nonce, .nonceDelta=(len+blen-1)/blen,
       .msg=dest, .mask=mask, .len=len,
-      .srcParty=r->box->srcParty, .trans=r->box->pd->trans, .isCorr = false
+      .srcParty=r->box->srcParty, .trans=r->box->pd->trans, .pool=&r->pool,
+      .isCorr = false
     };
     recverExtensionBoxRecvMsgs(&args);
     r->nonce=args.nonce;
@@ -2051,3 +2568,368 @@ void yaoUseFullOTExt(ProtocolDesc* pd,int me)
   else ypd->recver =
     maliciousOTExtRecverAbstract(otExtRecverNew(pd,1));
 }
+
+/* Silent correlated OT (Ferret, semi-honest). Both sides keep a stock of
+   COTs under one global Delta, M_i = K_i ^ b_i*Delta: the sender has Delta
+   and K_i, the receiver M_i. Delta has its low bit set, so b_i is the low bit
+   of M_i^K_i and nobody stores choice bits. A refill runs one iteration of
+   regular-noise LPN, which uses up t*h+k COTs from the stock and adds n:
+     - t single-point COTs, one per bucket of 2^h outputs. Each is a GGM tree
+       the receiver learns all but one leaf of, through h used COTs, whose low
+       bits pick the missing leaf. That is the only traffic, t*(32h+16) bytes.
+     - A public sparse matrix adds SILENT_LPN_D of the other k used COTs into
+       every output.
+   The very first stock comes from the honest OT extension. Each COT is then
+   used for one OT: the receiver sends d = sel^b, and the sender the
+   messages under H(K ^ (d^lsb(K))*Delta) and H(K ^ ~(d^lsb(K))*Delta).
+   */
+typedef struct { int n,t,k,h; } SilentLPNParams;
+// Ferret's parameters (as in emp-ot's ferret_b13), both for 128-bit security
+static const SilentLPNParams silentSmall = {470016,918,32768,9},
+                             silentLarge = {10485760,1280,452000,13};
+#define SILENT_LPN_D 10
+#define SILENT_LPN_BATCH 256
+#define silentBaseCount(p) ((size_t)(p)->t*(p)->h+(p)->k)
+
+typedef struct
+{ ProtocolDesc* pd;
+  int peer;
+  bool isSender;
+  block delta;      // sender only
+  block* cot;       // the stock, K_i or M_i. Used up from the end
+  size_t have, cap;
+  uint64_t tweak;   // for the hash, one per COT used
+  BCipherRandomGen *gen, *padder;
+  proxy_GGMPRG prg;
+  proxy_AESCTR lpn;
+} SilentOT;
+typedef struct SilentOTSender { SilentOT so; } SilentOTSender;
+typedef struct SilentOTRecver { SilentOT so; } SilentOTRecver;
+
+static void silentSpcotSend(SilentOT* o,const SilentLPNParams* p,
+                            const block* base,block* out,block* msg)
+{
+  const size_t l = (size_t)1<<p->h, th = (size_t)p->t*p->h;
+  block *hin = malloc(2*th*sizeof(block)), sum[2], all;
+  uint64_t *tweak = malloc(2*th*sizeof(uint64_t));
+  size_t i,j,x;
+  for(i=0;i<th;++i)
+  { // keys for choice bits 0 and 1
+    hin[2*i] = (getLSB(base[i])?xorBlocks(base[i],o->delta):base[i]);
+    hin[2*i+1] = xorBlocks(hin[2*i],o->delta);
+    tweak[2*i] = tweak[2*i+1] = o->tweak+i;
+  }
+  TCCRH_hash_n(&otPadHash,hin,tweak,msg,2*th);
+  for(j=0;j<p->t;++j)
+  { block *lv = out+j*l, *m = msg+2*j*p->h;
+    randomizeBuffer(o->gen,(char*)lv,sizeof(block));
+    for(i=1;i<=p->h;++i)
+    { GGMPRG_expand(&o->prg,lv,lv,(size_t)1<<(i-1));
+      sum[0] = sum[1] = zero_block();
+      for(x=0;x<((size_t)1<<i);++x) sum[x&1] = xorBlocks(sum[x&1],lv[x]);
+      m[2*i-2] = xorBlocks(m[2*i-2],sum[0]);
+      m[2*i-1] = xorBlocks(m[2*i-1],sum[1]);
+    }
+    all = o->delta;
+    for(x=0;x<l;++x) all = xorBlocks(all,lv[x]);
+    msg[2*th+j] = all;
+  }
+  free(hin); free(tweak);
+}
+// Leaves come out as the sender's, except the missing one, which is that
+//   xor Delta. The noise vector is then just where those are
+static void silentSpcotRecv(SilentOT* o,const SilentLPNParams* p,
+                            const block* base,block* out,const block* msg)
+{
+  const size_t l = (size_t)1<<p->h, th = (size_t)p->t*p->h;
+  block *hk = malloc(th*sizeof(block)), s;
+  uint64_t *tweak = malloc(th*sizeof(uint64_t));
+  size_t i,j,x,path;
+  for(i=0;i<th;++i) tweak[i] = o->tweak+i;
+  TCCRH_hash_n(&otPadHash,base,tweak,hk,th);
+  for(j=0;j<p->t;++j)
+  { block *lv = out+j*l;
+    const block *b = base+j*p->h, *m = msg+2*j*p->h, *h = hk+j*p->h;
+    lv[0] = zero_block(); // we never learn the path nodes
+    path = 0;
+    for(i=1;i<=p->h;++i)
+    { // We learn the sum on side c, so the path goes the other way
+      const bool c = getLSB(b[i-1]);
+      const size_t sib = 2*path+c;
+      GGMPRG_expand(&o->prg,lv,lv,(size_t)1<<(i-1));
+      s = xorBlocks(m[2*i-2+c],h[i-1]);
+      for(x=c;x<((size_t)1<<i);x+=2) if(x!=sib) s = xorBlocks(s,lv[x]);
+      lv[sib] = s;
+      path = 2*path+!c;
+      lv[path] = zero_block();
+    }
+    s = msg[2*th+j];
+    for(x=0;x<l;++x) s = xorBlocks(s,lv[x]);
+    lv[path] = s;
+  }
+  free(hk); free(tweak);
+}
+// out[i] ^= the secret at SILENT_LPN_D public random indices, scaled into
+//   [0,k) by a multiply rather than a division
+static void silentLpnEncode(SilentOT* o,const SilentLPNParams* p,
+                            const block* secret,block* out)
+{
+  block r[3*SILENT_LPN_BATCH], acc;
+  size_t i,j,m;
+  int d;
+  AESCTR_setKey(&o->lpn,makeBlock(p->n,p->k));
+  for(i=0;i<p->n;i+=SILENT_LPN_BATCH)
+  { m = (p->n-i<SILENT_LPN_BATCH?p->n-i:SILENT_LPN_BATCH);
+    AESCTR_gen(&o->lpn,3*i,r,3*m);
+    for(j=0;j<m;++j)
+    { const uint32_t* idx = (const uint32_t*)(r+3*j);
+      acc = out[i+j];
+      for(d=0;d<SILENT_LPN_D;++d) acc = xorBlocks(acc,secret[(uint64_t)idx[d]*p->k>>32]);
+      out[i+j] = acc;
+    }
+  }
+}
+static void silentOTRefill(SilentOT* o,const SilentLPNParams* p)
+{
+  const size_t m = silentBaseCount(p), th = (size_t)p->t*p->h,
+               msgn = 2*th+p->t;
+  block *base = malloc(m*sizeof(block)), *msg = malloc(msgn*sizeof(block));
+  block *out;
+  assert(o->have>=m);
+  o->have -= m;
+  memcpy(base,o->cot+o->have,m*sizeof(block));
+  if(o->have+p->n>o->cap)
+  { o->cap = o->have+p->n;
+    o->cot = realloc(o->cot,o->cap*sizeof(block));
+  }
+  out = o->cot+o->have;
+  if(o->isSender)
+  { silentSpcotSend(o,p,base,out,msg);
+    osend(o->pd,o->peer,msg,msgn*sizeof(block));
+  }else
+  { orecv(o->pd,o->peer,msg,msgn*sizeof(block));
+    silentSpcotRecv(o,p,base,out,msg);
+  }
+  o->tweak += th;
+  silentLpnEncode(o,p,base+th,out);
+  o->have += p->n;
+  free(base); free(msg);
+}
+// Returns n COTs, valid until the next call. What is left is always enough
+//   for a small refill, and large refills kick in for large requests
+static const block* silentOTTake(SilentOT* o,size_t n)
+{
+  const size_t keep = silentBaseCount(&silentSmall);
+  while(o->have<n+keep)
+    silentOTRefill(o,n+keep-o->have>silentSmall.n-keep
+                   && o->have>=silentBaseCount(&silentLarge)
+                   ?&silentLarge:&silentSmall);
+  o->have -= n;
+  return o->cot+o->have;
+}
+
+static void silentCorrDelta(char* dest,const char* src,int i,void* delta)
+{
+  memcpy(dest,src,sizeof(block));
+  memxor(dest,delta,sizeof(block));
+}
+static void silentOTInit(SilentOT* o,ProtocolDesc* pd,int peer,bool isSender)
+{
+  const size_t m = silentBaseCount(&silentSmall);
+  size_t i;
+  o->pd = pd;
+  o->peer = peer;
+  o->isSender = isSender;
+  o->cot = malloc(m*sizeof(block));
+  o->have = o->cap = m;
+  o->tweak = 0;
+  o->gen = newBCipherRandomGen();
+  o->padder = newBCipherRandomGen();
+  GGMPRG_init(&o->prg);
+  AESCTR_init(&o->lpn);
+  pthread_once(&otPadHashDone,otPadHashInit);
+  if(isSender)
+  { HonestOTExtSender* s = honestOTExtSenderNew(pd,peer);
+    block* opt1 = malloc(m*sizeof(block));
+    randomizeBuffer(o->gen,(char*)&o->delta,sizeof(block));
+    o->delta = make_delta(o->delta);
+    honestCorrelatedOTExtSend1Of2(s,(char*)o->cot,(char*)opt1,m,
+        sizeof(block),silentCorrDelta,&o->delta);
+    honestOTExtSenderRelease(s);
+    free(opt1);
+  }else
+  { HonestOTExtRecver* r = honestOTExtRecverNew(pd,peer);
+    bool* sel = malloc(m*sizeof(bool));
+    randomizeBuffer(o->gen,(char*)sel,m*sizeof(bool));
+    for(i=0;i<m;++i) sel[i] &= 1;
+    honestCorrelatedOTExtRecv1Of2(r,(char*)o->cot,sel,m,sizeof(block));
+    honestOTExtRecverRelease(r);
+    free(sel);
+  }
+}
+static void silentOTCleanup(SilentOT* o)
+{
+  releaseBCipherRandomGen(o->gen);
+  releaseBCipherRandomGen(o->padder);
+  GGMPRG_release(&o->prg);
+  AESCTR_release(&o->lpn);
+  free(o->cot);
+}
+// dest ^= len bytes of pad from the hash h
+static void silentPadXor(SilentOT* o,char* dest,const block* h,int len)
+{
+  if(len<=sizeof(block)) memxor(dest,h,len);
+  else
+  { char *pad = malloc(len);
+    resetBCipherRandomGen(o->padder,(const char*)h);
+    setctrFromIntBCipherRandomGen(o->padder,0);
+    randomizeBuffer(o->padder,pad,len);
+    memxor(dest,pad,len);
+    free(pad);
+  }
+}
+
+SilentOTSender* silentOTSenderNew(ProtocolDesc* pd,int destParty)
+{
+  SilentOTSender* s = malloc(sizeof *s);
+  silentOTInit(&s->so,pd,destParty,true);
+  return s;
+}
+void silentOTSenderRelease(SilentOTSender* s)
+  { silentOTCleanup(&s->so); free(s); }
+SilentOTRecver* silentOTRecverNew(ProtocolDesc* pd,int srcParty)
+{
+  SilentOTRecver* r = malloc(sizeof *r);
+  silentOTInit(&r->so,pd,srcParty,false);
+  return r;
+}
+void silentOTRecverRelease(SilentOTRecver* r)
+  { silentOTCleanup(&r->so); free(r); }
+
+// Receives d, and hashes out pads for messages 0 and 1 into h
+static void silentOTSenderPads(SilentOT* o,block* h,int n)
+{
+  const block* k = silentOTTake(o,n);
+  char *d = malloc((n+7)/8);
+  uint64_t *tweak = malloc(2*n*sizeof(uint64_t));
+  int i;
+  orecv(o->pd,o->peer,d,(n+7)/8);
+  for(i=0;i<n;++i)
+  { h[2*i] = (getLSB(k[i])!=getBit(d,i)?xorBlocks(k[i],o->delta):k[i]);
+    h[2*i+1] = xorBlocks(h[2*i],o->delta);
+    tweak[2*i] = tweak[2*i+1] = o->tweak+i;
+  }
+  TCCRH_hash_n(&otPadHash,h,tweak,h,2*n);
+  o->tweak += n;
+  free(d); free(tweak);
+}
+// Sends d, and hashes out the pad for message sel into h
+static void silentOTRecverPads(SilentOT* o,block* h,const bool* sel,int n)
+{
+  const block* m = silentOTTake(o,n);
+  char *d = calloc((n+7)/8,1);
+  uint64_t *tweak = malloc(n*sizeof(uint64_t));
+  int i;
+  for(i=0;i<n;++i)
+  { setBit(d,i,sel[i]!=getLSB(m[i]));
+    tweak[i] = o->tweak+i;
+  }
+  osend(o->pd,o->peer,d,(n+7)/8);
+  TCCRH_hash_n(&otPadHash,m,tweak,h,n);
+  o->tweak += n;
+  free(d); free(tweak);
+}
+void silentOTSend1Of2(SilentOTSender* s,const char* opt0,const char* opt1,
+    int n,int len)
+{
+  block *h = malloc(2*n*sizeof(block));
+  char *e = malloc(2*(size_t)n*len);
+  int i;
+  silentOTSenderPads(&s->so,h,n);
+  for(i=0;i<n;++i)
+  { memcpy(e+2*i*len,opt0+i*len,len);
+    silentPadXor(&s->so,e+2*i*len,h+2*i,len);
+    memcpy(e+(2*i+1)*len,opt1+i*len,len);
+    silentPadXor(&s->so,e+(2*i+1)*len,h+2*i+1,len);
+  }
+  osend(s->so.pd,s->so.peer,e,2*(size_t)n*len);
+  free(h); free(e);
+}
+void silentOTRecv1Of2(SilentOTRecver* r,char* dest,const bool* sel,
+    int n,int len)
+{
+  block *h = malloc(n*sizeof(block));
+  char *e = malloc(2*(size_t)n*len);
+  int i;
+  silentOTRecverPads(&r->so,h,sel,n);
+  orecv(r->so.pd,r->so.peer,e,2*(size_t)n*len);
+  for(i=0;i<n;++i)
+  { memcpy(dest+i*len,e+(2*i+sel[i])*len,len);
+    silentPadXor(&r->so,dest+i*len,h+i,len);
+  }
+  free(h); free(e);
+}
+// opt0 comes out as random pads, opt1 as f of those. Only opt1 is sent
+void silentCorrelatedOTSend1Of2(SilentOTSender* s,char* opt0,char* opt1,
+    int n,int len,OcOtCorrelator f,void* corrArg)
+{
+  block *h = malloc(2*n*sizeof(block));
+  char *e = malloc((size_t)n*len);
+  int i;
+  silentOTSenderPads(&s->so,h,n);
+  memset(opt0,0,(size_t)n*len);
+  for(i=0;i<n;++i)
+  { silentPadXor(&s->so,opt0+i*len,h+2*i,len);
+    f(opt1+i*len,opt0+i*len,i,corrArg);
+    memcpy(e+i*len,opt1+i*len,len);
+    silentPadXor(&s->so,e+i*len,h+2*i+1,len);
+  }
+  osend(s->so.pd,s->so.peer,e,(size_t)n*len);
+  free(h); free(e);
+}
+void silentCorrelatedOTRecv1Of2(SilentOTRecver* r,char* dest,
+    const bool* sel,int n,int len)
+{
+  block *h = malloc(n*sizeof(block));
+  int i;
+  silentOTRecverPads(&r->so,h,sel,n);
+  orecv(r->so.pd,r->so.peer,dest,(size_t)n*len);
+  for(i=0;i<n;++i)
+  { if(!sel[i]) memset(dest+i*len,0,len);
+    silentPadXor(&r->so,dest+i*len,h+i,len);
+  }
+  free(h);
+}
+
+void silentWrapperSend(void* s,const char* opt0,const char* opt1,
+    int n,int len) { silentOTSend1Of2(s,opt0,opt1,n,len); }
+void silentWrapperRecv(void* r,char* dest,const bool* sel,
+    int n,int len) { silentOTRecv1Of2(r,dest,sel,n,len); }
+void silentWrapperCorrSend(void* s,char* opt0,char* opt1,int n,int len,
+    OcOtCorrelator f,void* corrArg)
+  { silentCorrelatedOTSend1Of2(s,opt0,opt1,n,len,f,corrArg); }
+void silentWrapperCorrRecv(void* r,char* dest,const bool* sel,
+    int n,int len) { silentCorrelatedOTRecv1Of2(r,dest,sel,n,len); }
+
+OTsender silentOTSenderAbstract(SilentOTSender* s)
+{ return (OTsender){.sender=s, .send=silentWrapperSend,
+                    .release=(void(*)(void*))silentOTSenderRelease};
+}
+OTrecver silentOTRecverAbstract(SilentOTRecver* r)
+{ return (OTrecver){.recver=r, .recv=silentWrapperRecv,
+                    .release=(void(*)(void*))silentOTRecverRelease};
+}
+COTsender silentCOTSenderAbstract(SilentOTSender* s)
+{ return (COTsender){.sender=s, .send=silentWrapperCorrSend,
+                     .release=(void(*)(void*))silentOTSenderRelease};
+}
+COTrecver silentCOTRecverAbstract(SilentOTRecver* r)
+{ return (COTrecver){.recver=r, .recv=silentWrapperCorrRecv,
+                     .release=(void(*)(void*))silentOTRecverRelease};
+}
+
+void yaoUseSilentOT(ProtocolDesc* pd,int me)
+{ YaoProtocolDesc* ypd = pd->extra;
+  if(me==1) ypd->sender = silentOTSenderAbstract(silentOTSenderNew(pd,2));
+  else ypd->recver = silentOTRecverAbstract(silentOTRecverNew(pd,1));
+}
@@ -83,7 +83,6 @@ typedef struct
   bool broadcast1;
   // Add more stuff here
 } NpProtocolExtra;
-#define OC_YPD_TYPE_NP 3
 
 OC_DYN_EXTRA_FUN(ypdNpProtocolExtra,YaoProtocolDesc,
                  NpProtocolExtra,OC_YPD_TYPE_NP)
@@ -277,11 +276,15 @@ static bool execNpProtocolAux(ProtocolDesc* pd, bool bcast1,
   // override protocol methods
   pd->feedOblivInputs = (me==1?npGenrFeedOblivInputs:npEvalFeedOblivInputs);
   pd->revealOblivBits = (me==1?npGenrRevealOblivBits:npEvalRevealOblivBits);
+  pd->revealOblivBitsN = NULL;
   pd->setBitAnd = (me==1?npGenerateAnd:npEvaluateAnd);
   pd->setBitOr  = (me==1?npGenerateOr :npEvaluateOr );
   pd->setBitXor = npSetBitXor;
   pd->setBitNot = npSetBitNot;
   pd->flipBit   = npFlipBit;
+  pd->setBitsAndN = NULL;
+  pd->setBitsOrN  = NULL;
+  pd->muxN        = NULL;
 
   yaoUseNpot(pd,me);
   mainYaoProtocol(pd,false,start,arg);
@@ -0,0 +1,370 @@
+/*
+   Circuit tracing protocol. Runs a protocol_run with no peer, and instead of
+   evaluating anything, writes out the circuit it builds as a netlist. Control
+   flow must not depend on revealed values, since there are none.
+
+   Wires are numbered in creation order. Wire 0 is the constant false, input
+   bits and gate outputs get 1, 2, ... An OblivBit holds a literal, i.e.
+   wire<<1 | inverted, so NOT is free here as it is in Yao. OR is written as
+   an AND with all three inversions, and XOR moves its inversions to the
+   output, so the netlist only has AND and XOR gates.
+
+   File layout: the magic "OCTRACE1", then OcTraceCounts (7 uint64 in host
+   byte order), then records. Each record starts with one byte:
+     'I' party n        n new input wires fed by party (1 byte)
+     'A' x y            AND of two literals, defines the next wire
+     'X' x y            XOR of two (non-inverted) literals, likewise
+     'O' party n x...   n literals revealed to party (0 for everyone)
+   n is a LEB128 varint, and so is each literal: it is stored relative to
+   the next free wire w as ((w-1-wire)<<1 | inverted), so the operands of a
+   gate are usually one or two bytes each.
+   */
+
+#include<obliv.h>
+#include<obliv_bits.h>
+#include<obliv_common.h>
+#include<inttypes.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+static const char traceMagic[8] = "OCTRACE1";
+
+typedef struct
+{ char protoType;
+  FILE* f;
+  uint64_t next; // next free wire
+  OcTraceCounts counts;
+} TraceProtocolDesc;
+
+// ------------------------------- Writing -----------------------------------
+
+static void traceVarint(FILE* f,uint64_t v)
+{ while(v>=0x80) { putc((v&0x7f)|0x80,f); v>>=7; }
+  putc(v,f);
+}
+
+static void traceLit(TraceProtocolDesc* tpd,uint64_t lit)
+  { traceVarint(tpd->f,((tpd->next-1-(lit>>1))<<1)|(lit&1)); }
+
+static inline uint64_t traceGet(const OblivBit* b)
+  { uint64_t lit; memcpy(&lit,b->trace,sizeof(lit)); return lit; }
+static inline void traceSet(OblivBit* b,uint64_t lit)
+  { memcpy(b->trace,&lit,sizeof(lit)); b->unknown = true; }
+
+static uint64_t traceBitLit(const OblivBit* b)
+  { return b->unknown?traceGet(b):b->knownValue; } // constants are wire 0
+
+static void traceHeader(TraceProtocolDesc* tpd)
+{ fseek(tpd->f,0,SEEK_SET);
+  fwrite(traceMagic,1,sizeof(traceMagic),tpd->f);
+  fwrite(&tpd->counts,sizeof(tpd->counts),1,tpd->f);
+}
+
+static void traceGate(ProtocolDesc* pd,OblivBit* dest,
+    char op,uint64_t a,uint64_t b,bool inv)
+{ TraceProtocolDesc* tpd = pd->extra;
+  putc(op,tpd->f);
+  traceLit(tpd,a);
+  traceLit(tpd,b);
+  if(op=='A') tpd->counts.andGates++; else tpd->counts.xorGates++;
+  traceSet(dest,(tpd->next++)<<1|inv);
+}
+
+static void traceSetBitAnd(ProtocolDesc* pd,
+    OblivBit* dest,const OblivBit* a,const OblivBit* b)
+  { traceGate(pd,dest,'A',traceGet(a),traceGet(b),false); }
+
+static void traceSetBitOr(ProtocolDesc* pd,
+    OblivBit* dest,const OblivBit* a,const OblivBit* b)
+  { traceGate(pd,dest,'A',traceGet(a)^1,traceGet(b)^1,true); }
+
+static void traceSetBitXor(ProtocolDesc* pd,
+    OblivBit* dest,const OblivBit* a,const OblivBit* b)
+{ uint64_t x=traceGet(a), y=traceGet(b);
+  traceGate(pd,dest,'X',x&~1ull,y&~1ull,(x^y)&1);
+}
+
+static void traceSetBitNot(ProtocolDesc* pd,OblivBit* dest,const OblivBit* a)
+  { traceSet(dest,traceGet(a)^1); }
+
+static void traceFlipBit(ProtocolDesc* pd,OblivBit* dest)
+  { traceSet(dest,traceGet(dest)^1); }
+
+// Values are ignored, every fed bit just becomes a new input wire
+static void traceFeedOblivInputs(ProtocolDesc* pd,
+    OblivInputs* spec,size_t count,int party)
+{ TraceProtocolDesc* tpd = pd->extra;
+  size_t i,j,n=0;
+  for(i=0;i<count;++i) n+=spec[i].size;
+  if(n==0) return;
+  putc('I',tpd->f);
+  putc(party,tpd->f);
+  traceVarint(tpd->f,n);
+  for(i=0;i<count;++i) for(j=0;j<spec[i].size;++j)
+    traceSet(&spec[i].dest[j],(tpd->next++)<<1);
+  tpd->counts.inputBits+=n;
+  tpd->counts.inputRecords++;
+}
+
+static bool traceRevealOblivBitsN(ProtocolDesc* pd,char* dest,
+    const OblivBit* o,size_t n,int party)
+{ TraceProtocolDesc* tpd = pd->extra;
+  size_t i;
+  putc('O',tpd->f);
+  putc(party,tpd->f);
+  traceVarint(tpd->f,n);
+  for(i=0;i<n;++i) traceLit(tpd,traceBitLit(o+i));
+  tpd->counts.outputBits+=n;
+  tpd->counts.outputRecords++;
+  return false;
+}
+
+static bool traceRevealOblivBits(ProtocolDesc* pd,widest_t* dest,
+    const OblivBit* o,size_t n,int party)
+  { return traceRevealOblivBitsN(pd,NULL,o,n,party); }
+
+static int traceNoPeerSend(ProtocolTransport* t,int d,const void* p,size_t n)
+{ fprintf(stderr,"execTraceProtocol: there is no peer to send to\n");
+  return -1;
+}
+static int traceNoPeerRecv(ProtocolTransport* t,int s,void* p,size_t n)
+{ fprintf(stderr,"execTraceProtocol: there is no peer to receive from\n");
+  return -1;
+}
+static void traceNoPeerCleanup(ProtocolTransport* t) {}
+
+// Runs start(arg) as party, alone, and writes what it computes to path.
+//   counts, if not NULL, gets the totals also stored in the file header.
+//   Returns 0 on success, -1 if the file could not be written.
+int execTraceProtocol(const char* path,int party,
+                      protocol_run start,void* arg,OcTraceCounts* counts)
+{
+  ProtocolTransport noPeer = {.maxParties=2, .split=NULL,
+    .send=traceNoPeerSend, .recv=traceNoPeerRecv, .flush=NULL,
+    .cleanup=traceNoPeerCleanup};
+  TraceProtocolDesc tpd = {.protoType=OC_PD_TYPE_TRACE, .next=1};
+  ProtocolDesc pd = {.partyCount=2, .thisParty=party, .error=0,
+    .trans=&noPeer, .currentParty=ocCurrentPartyDefault,
+    .feedOblivInputs=traceFeedOblivInputs,
+    .revealOblivBits=traceRevealOblivBits,
+    .revealOblivBitsN=traceRevealOblivBitsN,
+    .setBitAnd=traceSetBitAnd, .setBitOr=traceSetBitOr,
+    .setBitXor=traceSetBitXor, .setBitNot=traceSetBitNot,
+    .flipBit=traceFlipBit, .setBitsAndN=NULL, .setBitsOrN=NULL, .muxN=NULL,
+    .extra=&tpd, .splitextra=NULL, .cleanextra=NULL};
+  ProtocolDesc* saved = ocCurrentProto();
+  int res;
+
+  if(!(tpd.f = fopen(path,"wb"))) { perror("execTraceProtocol"); return -1; }
+  traceHeader(&tpd); // placeholder, counts are filled in at the end
+  ocSetCurrentProto(&pd);
+  start(arg);
+  ocSetCurrentProto(saved);
+  tpd.counts.wires = tpd.next;
+  traceHeader(&tpd);
+  res = ferror(tpd.f);
+  if(fclose(tpd.f)!=0 || res) { perror("execTraceProtocol"); return -1; }
+  if(counts) *counts = tpd.counts;
+  return 0;
+}
+
+// ------------------------- Bristol Fashion export --------------------------
+
+typedef struct
+{ FILE* f;
+  OcTraceCounts counts;
+  uint64_t next;
+} TraceReader;
+
+static bool traceReadVarint(FILE* f,uint64_t* v)
+{ int c, shift=0;
+  *v=0;
+  do
+  { if((c=getc(f))==EOF || shift>63) return false;
+    *v |= (uint64_t)(c&0x7f)<<shift;
+    shift+=7;
+  }while(c&0x80);
+  return true;
+}
+
+// Returns the literal in absolute form, wire<<1 | inverted
+static bool traceReadLit(TraceReader* r,uint64_t* lit)
+{ uint64_t v;
+  if(!traceReadVarint(r->f,&v) || (v>>1)>=r->next) return false;
+  *lit = (r->next-1-(v>>1))<<1|(v&1);
+  return true;
+}
+
+static bool traceReaderOpen(TraceReader* r,const char* path)
+{ char magic[sizeof(traceMagic)];
+  r->next = 1;
+  if(!(r->f = fopen(path,"rb"))) return false;
+  if(fread(magic,1,sizeof(magic),r->f)!=sizeof(magic)
+     || memcmp(magic,traceMagic,sizeof(magic))!=0
+     || fread(&r->counts,sizeof(r->counts),1,r->f)!=1)
+  { fclose(r->f); return false; }
+  return true;
+}
+
+static void traceReaderRewind(TraceReader* r)
+{ fseek(r->f,sizeof(traceMagic)+sizeof(r->counts),SEEK_SET);
+  r->next = 1;
+}
+
+// Bristol Fashion wants input wires first and output wires last, has no
+//   free inversion, and no constants except through EQ gates. So wires are
+//   renumbered: inputs in feeding order, then gate outputs in order, then
+//   one INV wire for each wire used inverted, then the constants that are
+//   used, then one EQW copy per output bit.
+typedef struct
+{ uint64_t inputs, gates, invs, consts;
+  uint64_t runs, *runStart, *runBefore; // input runs: first wire, inputs before
+  uint64_t *invBits, *invBefore;        // which wires need INV, and rank
+  bool constUsed[2];
+} BristolMap;
+
+static uint64_t bristolWire(const BristolMap* m,uint64_t w)
+{ uint64_t lo=0, hi=m->runs;
+  while(lo<hi) // first run starting after w
+  { uint64_t mid=(lo+hi)/2;
+    if(m->runStart[mid]<=w) lo=mid+1; else hi=mid;
+  }
+  if(lo==0) return m->inputs+w-1;
+  lo--;
+  uint64_t n = m->runBefore[lo+1]-m->runBefore[lo];
+  if(w<m->runStart[lo]+n) return m->runBefore[lo]+(w-m->runStart[lo]);
+  return m->inputs+w-1-m->runBefore[lo+1];
+}
+
+static uint64_t bristolLit(const BristolMap* m,uint64_t lit)
+{ uint64_t w = lit>>1;
+  if(w==0) return m->inputs+m->gates+m->invs
+                  +(lit==1 && m->constUsed[0]?1:0);
+  if(!(lit&1)) return bristolWire(m,w);
+  return m->inputs+m->gates+m->invBefore[w/64]
+         +__builtin_popcountll(m->invBits[w/64]&((1ull<<(w%64))-1));
+}
+
+static void bristolMarkLit(BristolMap* m,uint64_t lit)
+{ if((lit>>1)==0) m->constUsed[lit&1]=true;
+  else if(lit&1) m->invBits[(lit>>1)/64] |= 1ull<<((lit>>1)%64);
+}
+
+static void bristolEmitInv(FILE* out,const BristolMap* m,uint64_t w)
+{ if(m->invBits[w/64]>>(w%64)&1)
+    fprintf(out,"1 1 %" PRIu64 " %" PRIu64 " INV\n",
+        bristolWire(m,w),bristolLit(m,w<<1|1));
+}
+
+// Each 'I' record becomes one Bristol input value, each 'O' one output value.
+//   Returns 0 on success, -1 if the netlist is unreadable or path unwritable.
+int traceNetlistToBristol(const char* netlistPath,const char* bristolPath)
+{
+  TraceReader r;
+  BristolMap m = {0};
+  FILE* out = NULL;
+  uint64_t i, n, a=0, b=0, outWire, *inSizes, *outSizes, nin=0, nout=0, words;
+  int op, party, res=-1;
+  bool malformed=true;
+
+  if(!traceReaderOpen(&r,netlistPath))
+  { fprintf(stderr,"traceNetlistToBristol: cannot read %s\n",netlistPath);
+    return -1;
+  }
+  words = r.counts.wires/64+1;
+  m.invBits = calloc(words,sizeof(uint64_t));
+  m.invBefore = malloc((words+1)*sizeof(uint64_t));
+  m.runStart = malloc((r.counts.inputRecords+1)*sizeof(uint64_t));
+  m.runBefore = malloc((r.counts.inputRecords+1)*sizeof(uint64_t));
+  inSizes = malloc((r.counts.inputRecords+1)*sizeof(uint64_t));
+  outSizes = malloc((r.counts.outputRecords+1)*sizeof(uint64_t));
+  m.runBefore[0] = 0;
+
+  // Pass 1: input runs, and which wires are used inverted or constant
+  while((op=getc(r.f))!=EOF)
+  { if(op=='I')
+    { if((party=getc(r.f))==EOF || !traceReadVarint(r.f,&n)
+         || nin>=r.counts.inputRecords) goto done;
+      m.runStart[nin] = r.next;
+      m.runBefore[nin+1] = m.runBefore[nin]+n;
+      inSizes[nin++] = n;
+      r.next+=n;
+    }else if(op=='A' || op=='X')
+    { if(!traceReadLit(&r,&a) || !traceReadLit(&r,&b)) goto done;
+      bristolMarkLit(&m,a);
+      bristolMarkLit(&m,b);
+      r.next++;
+    }else if(op=='O')
+    { if((party=getc(r.f))==EOF || !traceReadVarint(r.f,&n)
+         || nout>=r.counts.outputRecords) goto done;
+      outSizes[nout++] = n;
+      for(i=0;i<n;++i)
+      { if(!traceReadLit(&r,&a)) goto done;
+        bristolMarkLit(&m,a);
+      }
+    }else goto done;
+    if(r.next>r.counts.wires) goto done;
+  }
+  m.runs = nin;
+  m.inputs = m.runBefore[nin];
+  m.gates = r.next-1-m.inputs;
+  m.invBefore[0] = 0;
+  for(i=0;i<words;++i)
+    m.invBefore[i+1] = m.invBefore[i]+__builtin_popcountll(m.invBits[i]);
+  m.invs = m.invBefore[words];
+  m.consts = m.constUsed[0]+m.constUsed[1];
+
+  malformed=false;
+  if(!(out = fopen(bristolPath,"w"))) { perror("traceNetlistToBristol"); goto done; }
+  n = r.counts.outputBits;
+  fprintf(out,"%" PRIu64 " %" PRIu64 "\n",m.gates+m.invs+m.consts+n,
+      m.inputs+m.gates+m.invs+m.consts+n);
+  fprintf(out,"%" PRIu64,nin);
+  for(i=0;i<nin;++i) fprintf(out," %" PRIu64,inSizes[i]);
+  fprintf(out,"\n%" PRIu64,nout);
+  for(i=0;i<nout;++i) fprintf(out," %" PRIu64,outSizes[i]);
+  fprintf(out,"\n\n");
+  for(i=0;i<2;++i) if(m.constUsed[i])
+    fprintf(out,"1 1 %" PRIu64 " %" PRIu64 " EQ\n",i,bristolLit(&m,i));
+  for(i=0;i<nin;++i) for(a=0;a<inSizes[i];++a)
+    bristolEmitInv(out,&m,m.runStart[i]+a);
+
+  // Pass 2: the gates, each followed by its INV if needed, and the outputs.
+  //   Pass 1 checked the records, so reads cannot fail here.
+  traceReaderRewind(&r);
+  outWire = m.inputs+m.gates+m.invs+m.consts;
+  while((op=getc(r.f))!=EOF)
+  { if(op=='I')
+    { getc(r.f);
+      traceReadVarint(r.f,&n);
+      r.next+=n;
+    }else if(op=='A' || op=='X')
+    { traceReadLit(&r,&a);
+      traceReadLit(&r,&b);
+      fprintf(out,"2 1 %" PRIu64 " %" PRIu64 " %" PRIu64 " %s\n",
+          bristolLit(&m,a),bristolLit(&m,b),bristolWire(&m,r.next),
+          op=='A'?"AND":"XOR");
+      bristolEmitInv(out,&m,r.next);
+      r.next++;
+    }else
+    { getc(r.f);
+      traceReadVarint(r.f,&n);
+      for(i=0;i<n;++i)
+      { traceReadLit(&r,&a);
+        fprintf(out,"1 1 %" PRIu64 " %" PRIu64 " EQW\n",
+            bristolLit(&m,a),outWire++);
+      }
+    }
+  }
+  res = (ferror(out)?-1:0);
+done:
+  if(malformed)
+    fprintf(stderr,"traceNetlistToBristol: %s is malformed\n",netlistPath);
+  if(out && fclose(out)!=0) res=-1;
+  fclose(r.f);
+  free(m.invBits); free(m.invBefore);
+  free(m.runStart); free(m.runBefore);
+  free(inSizes); free(outSizes);
+  return res;
+}
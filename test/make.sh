@@ -1 +1,4 @@
-../bin/oblivcc million.c million.oc common_util.c -I . -o million
\ No newline at end of file
+../bin/oblivcc million.c million.oc common_util.c -I . -o million
+../bin/oblivcc tlsbench.c -I . -o tlsbench
+../bin/oblivcc tlsintegrity.c -I . -o tlsintegrity
+../bin/oblivcc pipebig.c -I . -o pipebig
@@ -0,0 +1,80 @@
+// Measures the CPU cost of pushing garbled-table-sized traffic through the
+// TLS 2P transport, for a given TLS 1.3 cipher suite. Compare e.g.
+//   ./tlsbench 6601 -- 1024 TLS_AES_128_GCM_SHA256
+//   ./tlsbench 6601 localhost 1024 TLS_AES_128_GCM_SHA256
+// against the same pair of runs with TLS_SHA256_SHA256 (authentication only,
+// needs OpenSSL 3.4+). Party 1 sends, party 2 receives.
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/resource.h>
+#include<sys/time.h>
+#include<obliv.h>
+#include<obliv_common.h>
+
+#define CHUNK (16 * 4096) // 4096 garbled rows per send
+
+static double cpuSeconds()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+}
+
+static double wallSeconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int main(int argc,char *argv[])
+{
+	ProtocolDesc pd;
+	if(argc < 4) {
+		fprintf(stderr, "\033[0;32m[INFO]\033[0m Usage: %s <port> <--|remote_host> <megabytes> [ciphersuite]\n", argv[0]);
+		return 1;
+	}
+	const unsigned char key[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF};
+	const char* remote_host = (strcmp(argv[2], "--") == 0 ? NULL : argv[2]);
+	int party = (!remote_host ? 1 : 2);
+	long megabytes = atol(argv[3]);
+	if(megabytes <= 0) {
+		fprintf(stderr, "\033[0;31m[ERROR]\033[0m megabytes must be positive\n");
+		return 1;
+	}
+	size_t total = (size_t)megabytes << 20, done;
+
+	TLS2POptions opt = {0};
+	opt.buffer_size = 32768;
+	opt.ciphersuites = (argc > 4 ? argv[4] : NULL);
+	int res = (party == 1 ? protocolAcceptTLS2PEx(&pd, argv[1], key, &opt)
+		: protocolConnectTLS2PEx(&pd, remote_host, argv[1], key, &opt));
+	if(res != 0) {
+		fprintf(stderr, "\033[0;31m[ERROR]\033[0m TLS connection failed\n");
+		return 1;
+	}
+	setCurrentParty(&pd, party);
+
+	char* buf = malloc(CHUNK);
+	memset(buf, 0x5A, CHUNK);
+	double cpu = cpuSeconds(), wall = wallSeconds();
+	for(done = 0; done < total; done += CHUNK) {
+		if(party == 1) osend(&pd, 2, buf, CHUNK);
+		else orecv(&pd, 1, buf, CHUNK);
+	}
+	char ack = 0; // so the sender's timing includes delivery
+	if(party == 1) orecv(&pd, 2, &ack, 1);
+	else osend(&pd, 1, &ack, 1);
+	cpu = cpuSeconds() - cpu;
+	wall = wallSeconds() - wall;
+	cleanupProtocol(&pd);
+	free(buf);
+
+	double gb = done / (double)(1 << 30);
+	fprintf(stderr, "%s (party %d): %.2f GB, %.3f CPU s/GB, %.3f wall s/GB\n",
+		opt.ciphersuites ? opt.ciphersuites : "TLS_AES_128_GCM_SHA256",
+		party, gb, cpu / gb, wall / gb);
+	return 0;
+}
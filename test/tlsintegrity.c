@@ -0,0 +1,70 @@
+// Checks that the TLS 2P transport can run the integrity-only
+// TLS_SHA256_SHA256 suite, which needs OpenSSL 3.4+ and a lowered security
+// level. Forks into both parties on the given port and exchanges a message
+// each way. Prints SKIP and exits 0 on older OpenSSL.
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/wait.h>
+#include<openssl/crypto.h>
+#include<obliv.h>
+#include<obliv_common.h>
+
+#define SUITE "TLS_SHA256_SHA256"
+
+static int runParty(int party, const char* port)
+{
+	const unsigned char key[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF};
+	const char msg[] = "integrity only";
+	char buf[sizeof msg];
+	ProtocolDesc pd;
+	TLS2POptions opt = {0};
+	opt.buffer_size = 32768;
+	opt.ciphersuites = SUITE;
+	if(party == 2) usleep(200000); // let the server start listening
+	int res = (party == 1 ? protocolAcceptTLS2PEx(&pd, port, key, &opt)
+		: protocolConnectTLS2PEx(&pd, "localhost", port, key, &opt));
+	if(res != 0) {
+		fprintf(stderr, "\033[0;31m[ERROR]\033[0m party %d: TLS connection with %s failed\n", party, SUITE);
+		return 1;
+	}
+	setCurrentParty(&pd, party);
+	if(party == 1) {
+		osend(&pd, 2, msg, sizeof msg);
+		orecv(&pd, 2, buf, sizeof buf);
+	} else {
+		orecv(&pd, 1, buf, sizeof buf);
+		osend(&pd, 1, msg, sizeof msg);
+	}
+	oflush(&pd);
+	cleanupProtocol(&pd);
+	if(memcmp(buf, msg, sizeof msg) != 0) {
+		fprintf(stderr, "\033[0;31m[ERROR]\033[0m party %d: message garbled\n", party);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc,char *argv[])
+{
+	const char* port = (argc > 1 ? argv[1] : "6611");
+	if(OpenSSL_version_num() < 0x30400000L) {
+		printf("SKIP: %s needs OpenSSL 3.4+, this is %s\n", SUITE, OpenSSL_version(OPENSSL_VERSION));
+		return 0;
+	}
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if(pid == 0) return runParty(2, port);
+	int rv = runParty(1, port), status;
+	waitpid(pid, &status, 0);
+	if(rv != 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("FAIL: %s\n", SUITE);
+		return 1;
+	}
+	printf("PASS: %s\n", SUITE);
+	return 0;
+}